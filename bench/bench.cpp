@@ -0,0 +1,318 @@
+#include <chrono>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../src/theory.hpp"
+#include "../src/modelcheck.hpp"
+#include "../src/theories/theories.hpp"
+
+/*
+ * End-to-end benchmark of model checking searches over a grid of bounds and
+ * encodings, for regressions in smt-switch/Pono and to compare encodings.
+ *
+ * Every run is done from scratch (no cached encodings) in its own process,
+ * so that its peak memory can be measured.
+ */
+
+// One query of the cases file
+struct Case
+{
+    std::string theory, initial, final;
+};
+
+// One configuration of a query, and what running it took
+struct Row
+{
+    Case c;
+    std::string paths, nodes;
+    int depth, steps;
+    std::string result = "error";
+    int length = 0;
+    double parse = 0, upgrade = 0, encode = 0;
+    std::vector<double> bounds;
+    long rss = 0; // kilobytes
+};
+
+static double seconds(const std::chrono::steady_clock::time_point &since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+static std::vector<std::string> split(const std::string &s)
+{
+    std::vector<std::string> res;
+    std::stringstream ss(s);
+    std::string x;
+    while (getline(ss, x, ','))
+        res.push_back(x);
+    return res;
+}
+
+static std::string status_name(const SearchResult::Status &s)
+{
+    switch (s)
+    {
+    case SearchResult::Found:
+        return "found";
+    case SearchResult::Refuted:
+        return "refuted";
+    case SearchResult::NotFound:
+        return "notfound";
+    default:
+        return "error";
+    }
+}
+
+/**
+ * Read the queries to benchmark: a theory (name of a theory in src/theories,
+ * or path to a .dat file), an initial term and a final term, one per line
+ * (blank lines are ignored)
+ */
+static std::vector<Case> read_cases(const std::string &path)
+{
+    std::ifstream infile(path);
+    if (infile.fail())
+        throw std::runtime_error("Cannot read " + path);
+    std::vector<std::string> lines;
+    std::string line;
+    while (getline(infile, line))
+    {
+        if (line.find_first_not_of(" \t\r") != std::string::npos)
+            lines.push_back(line);
+    }
+    if (lines.size() % 3)
+        throw std::runtime_error("Expected (theory, initial, final) triples in " + path);
+    std::vector<Case> res;
+    for (size_t i = 0; i != lines.size(); i += 3)
+        res.push_back({lines.at(i), lines.at(i + 1), lines.at(i + 2)});
+    return res;
+}
+
+// Run one configuration, writing its measurements to fd. Never returns.
+[[noreturn]] static void child(const Row &row, const std::string &engine, const std::string &solver, const int &fd)
+{
+    std::stringstream ss;
+    try
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::ifstream infile(row.c.theory);
+        Theory parsed = infile.fail() ? get_theory(row.c.theory) : Theory::parseTheory(row.c.theory);
+        Expr x1 = parsed.parse_expr(row.c.initial), x2 = parsed.parse_expr(row.c.final);
+        double parse = seconds(start);
+
+        start = std::chrono::steady_clock::now();
+        Theory t = parsed.upgrade();
+        Expr initial = t.upgrade(x1), final = t.upgrade(x2);
+        double upgrade = seconds(start);
+
+        Encoding enc;
+        enc.paths = Encoding::parse_paths(row.paths);
+        enc.nodes = Encoding::parse_nodes(row.nodes);
+        McStats stats;
+        SearchResult res = mc_search(t, initial, final, row.steps, row.depth, "", "", enc, engine, solver, &stats);
+        ss << status_name(res.status) << " " << res.steps.size() << " "
+           << parse << " " << upgrade << " " << stats.encode;
+        for (auto &&b : stats.bounds)
+            ss << " " << b;
+    }
+    catch (const std::exception &e)
+    {
+        ss.str("error 0 0 0 0");
+        std::cerr << row.c.theory << ": " << e.what() << std::endl;
+    }
+    std::string msg = ss.str();
+    for (size_t done = 0; done < msg.size();)
+    {
+        ssize_t k = write(fd, msg.data() + done, msg.size() - done);
+        if (k <= 0)
+            break;
+        done += k;
+    }
+    close(fd);
+    _exit(0);
+}
+
+/**
+ * Run one configuration in a forked process
+ * @param timeout Seconds after which it is killed (0 means no limit)
+ */
+static void run(Row &row, const std::string &engine, const std::string &solver, const int &timeout)
+{
+    int p[2];
+    if (pipe(p))
+        throw std::runtime_error("Cannot create pipe");
+    pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("Cannot fork");
+    if (pid == 0)
+    {
+        close(p[0]);
+        if (timeout > 0)
+            alarm(timeout);
+        child(row, engine, solver, p[1]);
+    }
+    close(p[1]);
+
+    std::string msg;
+    char buf[4096];
+    for (ssize_t k; (k = read(p[0], buf, sizeof(buf))) > 0;)
+        msg.append(buf, k);
+    close(p[0]);
+
+    int status;
+    rusage usage;
+    wait4(pid, &status, 0, &usage);
+    row.rss = usage.ru_maxrss;
+    if (WIFSIGNALED(status))
+    {
+        row.result = WTERMSIG(status) == SIGALRM ? "timeout" : "crash";
+        return;
+    }
+    std::stringstream ss(msg);
+    ss >> row.result >> row.length >> row.parse >> row.upgrade >> row.encode;
+    for (double b; ss >> b;)
+        row.bounds.push_back(b);
+}
+
+static std::string csv_field(const std::string &s)
+{
+    std::string res = "\"";
+    for (auto &&c : s)
+        res += c == '"' ? std::string("\"\"") : std::string(1, c);
+    return res + "\"";
+}
+
+static std::string json_string(const std::string &s)
+{
+    std::string res = "\"";
+    for (auto &&c : s)
+    {
+        if (c == '"' || c == '\\')
+            res += '\\';
+        res += c;
+    }
+    return res + "\"";
+}
+
+static void write_csv(std::ostream &out, const std::vector<Row> &rows)
+{
+    out << "theory,initial,final,paths,nodes,depth,steps,result,length,"
+        << "parse_s,upgrade_s,encode_s,solve_s,bound_s,peak_rss_kb\n";
+    for (auto &&r : rows)
+    {
+        double solve = 0;
+        std::string bounds;
+        for (size_t k = 0; k != r.bounds.size(); k++)
+        {
+            solve += r.bounds.at(k);
+            bounds += (k ? ";" : "") + std::to_string(r.bounds.at(k));
+        }
+        out << csv_field(r.c.theory) << "," << csv_field(r.c.initial) << "," << csv_field(r.c.final) << ","
+            << r.paths << "," << r.nodes << "," << r.depth << "," << r.steps << ","
+            << r.result << "," << r.length << ","
+            << r.parse << "," << r.upgrade << "," << r.encode << "," << solve << ","
+            << csv_field(bounds) << "," << r.rss << "\n";
+    }
+}
+
+static void write_json(std::ostream &out, const std::vector<Row> &rows)
+{
+    out << "[\n";
+    for (size_t i = 0; i != rows.size(); i++)
+    {
+        const Row &r = rows.at(i);
+        out << "  {\"theory\": " << json_string(r.c.theory)
+            << ", \"initial\": " << json_string(r.c.initial)
+            << ", \"final\": " << json_string(r.c.final)
+            << ", \"paths\": " << json_string(r.paths)
+            << ", \"nodes\": " << json_string(r.nodes)
+            << ", \"depth\": " << r.depth << ", \"steps\": " << r.steps
+            << ", \"result\": " << json_string(r.result) << ", \"length\": " << r.length
+            << ", \"parse_s\": " << r.parse << ", \"upgrade_s\": " << r.upgrade
+            << ", \"encode_s\": " << r.encode << ", \"bound_s\": [";
+        for (size_t k = 0; k != r.bounds.size(); k++)
+            out << (k ? ", " : "") << r.bounds.at(k);
+        out << "], \"peak_rss_kb\": " << r.rss << "}" << (i + 1 != rows.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+int main(int argc, char **argv)
+{
+    std::string cases = "data/bench/cases", csv, json, engine = "bmc", solver = "cvc4";
+    std::vector<std::string> depths{"1", "2", "3"}, steps{"3", "6"}, paths{"enumerated", "levels"}, nodes{"int"};
+    int timeout = 300;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--cases" && i + 1 < argc)
+            cases = argv[++i];
+        else if (arg == "--depths" && i + 1 < argc)
+            depths = split(argv[++i]);
+        else if (arg == "--steps" && i + 1 < argc)
+            steps = split(argv[++i]);
+        else if (arg == "--paths" && i + 1 < argc)
+            paths = split(argv[++i]);
+        else if (arg == "--nodes" && i + 1 < argc)
+            nodes = split(argv[++i]);
+        else if (arg == "--engine" && i + 1 < argc)
+            engine = argv[++i];
+        else if (arg == "--solver" && i + 1 < argc)
+            solver = argv[++i];
+        else if (arg == "--timeout" && i + 1 < argc)
+            timeout = std::stoi(argv[++i]);
+        else if (arg == "--csv" && i + 1 < argc)
+            csv = argv[++i];
+        else if (arg == "--json" && i + 1 < argc)
+            json = argv[++i];
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--cases FILE] [--depths D,...] [--steps N,...] [--paths enumerated,levels] [--nodes int,bv] [--engine bmc|kind|ic3|interp] [--solver cvc4|z3] [--timeout SECONDS] [--csv FILE] [--json FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Row> rows;
+    for (auto &&c : read_cases(cases))
+    {
+        for (auto &&p : paths)
+        {
+            for (auto &&n : nodes)
+            {
+                for (auto &&d : depths)
+                {
+                    for (auto &&s : steps)
+                    {
+                        Row row{c, p, n, std::stoi(d), std::stoi(s)};
+                        run(row, engine, solver, timeout);
+                        std::cerr << c.theory << " " << p << " " << n << " depth " << d << " steps " << s
+                                  << ": " << row.result << std::endl;
+                        rows.push_back(row);
+                    }
+                }
+            }
+        }
+    }
+
+    if (csv.empty() && json.empty())
+        write_csv(std::cout, rows);
+    if (!csv.empty())
+    {
+        std::ofstream out(csv);
+        write_csv(out, rows);
+    }
+    if (!json.empty())
+    {
+        std::ofstream out(json);
+        write_json(out, rows);
+    }
+    return 0;
+}
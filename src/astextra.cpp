@@ -1,5 +1,6 @@
 #include "astextra.hpp"
 #include "cvc4extra.hpp"
+#include "pattern.hpp"
 
 /*
  * Functions related to rewriting AST terms in swt-switch
@@ -19,19 +20,31 @@ bool check_equal(smt::SmtSolver &slv,
 std::tuple<smt::Sort, smt::Sort, smt::Sort> create_datatypes(
     smt::SmtSolver &slv,
     const Theory &t,
-    const int &depth)
+    const int &depth,
+    const Encoding &enc)
 {
     const int arity = t.max_arity();
-    const Vvvi paths = all_paths(depth, arity);
-    smt::Sort Int = slv->make_sort(smt::INT);
+    const Vvvi paths = enc.paths == Encoding::Levels ? Vvvi{} : all_paths(depth, arity);
+    smt::Sort Int = intsort(slv);
     const char fr[2] = {'f', 'r'}; // Forward/reverse
+    const int nrules = std::max(1, static_cast<int>(t.rules.size()));
+
+    smt::Sort nodeSort = Int;
+    if (enc.nodes == Encoding::BitVectors)
+    {
+        // Room for every code below the flag bit, and for at least one step
+        if (enc.node_bits < offset_bits + 2 || enc.node_bits > 32 ||
+            t.symcode().size() >> (enc.node_bits - 1))
+            throw std::runtime_error("Cannot encode the theory with " + std::to_string(enc.node_bits) + "-bit nodes");
+        nodeSort = slv->make_sort(smt::BV, enc.node_bits);
+    }
 
     // AST
     smt::DatatypeDecl astSpec = slv->make_datatype_decl("AST");
     slv->add_constructor(astSpec, slv->make_datatype_constructor_decl("Error"));
     slv->add_constructor(astSpec, slv->make_datatype_constructor_decl("None"));
     smt::DatatypeConstructorDecl ast = slv->make_datatype_constructor_decl("ast");
-    slv->add_selector(ast, "node", Int);
+    slv->add_selector(ast, "node", nodeSort);
     for (int i = 0; i <= arity; i++)
         slv->add_selector_self(ast, "a" + std::to_string(i));
 
@@ -40,19 +53,37 @@ std::tuple<smt::Sort, smt::Sort, smt::Sort> create_datatypes(
 
     // PATH
     smt::DatatypeDecl pathSpec = slv->make_datatype_decl("Path");
-    slv->add_constructor(pathSpec, slv->make_datatype_constructor_decl("Empty"));
-    for (auto &&pp : paths)
+    if (enc.paths == Encoding::Levels)
+    {
+        smt::DatatypeConstructorDecl path = slv->make_datatype_constructor_decl("path");
+        slv->add_selector(path, "len", Int);
+        for (int i = 1; i <= depth; i++)
+            slv->add_selector(path, "c" + std::to_string(i), Int);
+        slv->add_constructor(pathSpec, path);
+    }
+    else
     {
-        for (auto &&p : pp)
+        slv->add_constructor(pathSpec, slv->make_datatype_constructor_decl("Empty"));
+        for (auto &&pp : paths)
         {
-            slv->add_constructor(pathSpec, slv->make_datatype_constructor_decl("P" + join(p)));
+            for (auto &&p : pp)
+            {
+                slv->add_constructor(pathSpec, slv->make_datatype_constructor_decl("P" + join(p)));
+            }
         }
     }
     smt::Sort pathSort = slv->make_sort(pathSpec);
 
     // RULE
+    if (enc.nodes == Encoding::BitVectors)
+    {
+        int bits = 1;
+        while ((1 << bits) < 2 * nrules)
+            bits++;
+        return std::make_tuple(astSort, pathSort, slv->make_sort(smt::BV, bits));
+    }
     smt::DatatypeDecl ruleSpec = slv->make_datatype_decl("Rule");
-    for (int i = 1; i != std::max(2, static_cast<int>(t.rules.size() + 1)); i++)
+    for (int i = 1; i <= nrules; i++)
     {
         for (auto &&d : fr)
         {
@@ -71,48 +102,37 @@ smt::Term pat_fun(const smt::SmtSolver &slv,
                   const Theory &thry,
                   const smt::Term &x,
                   const int &r,
-                  const std::string &dir)
+                  const std::string &dir,
+                  Subterms *xs)
 {
-
-    std::map<std::string, int> syms = thry.symcode();
-    Rule rule = thry.rules.at(r - 1);
-    Expr term = dir == "f" ? rule.t1 : rule.t2;
-    std::map<size_t, Vvi> groups = Expr::distinct(term.gethash());
+    TermCount count("pat_fun");
+    Subterms local(slv, x);
+    Subterms &subs = xs ? *xs : local;
+    const Pattern &pat = thry.program(r, dir == "f");
+    smt::Sort ns = nodesort(slv, x->get_sort());
     Vt andargs; // Represent term as list of constraints
 
-    //std::cout << "ENTERING FOR LOOP for pattern " << term << std::endl;
-    for (auto &&[k, v] : groups)
+    // Node+leaf constraint on each distinct non-variable subterm
+    for (auto &&c : pat.checks)
     {
-        Vi rep = v.front(); // choose representative of equiv class
-        //std::cout << "GETTING repE with rep size " << rep.size() << std::endl ;
-        smt::Term repE = subterm(slv, x, rep);
-        Expr repX = term.subexpr(rep);
-        const int sym = syms.at(repX.sym);
+        smt::Term repE = subs.at(c.path);
+        andargs.push_back(slv->make_term(smt::Equal, node(slv, repE), numeral(slv, c.code, ns)));
+        for (int i = c.nargs; i != arity(slv, x->get_sort()); i++)
+            andargs.push_back(test(slv, getarg(slv, repE, i), "None"));
+    }
 
-        // Node+leaf constraint on representative if not a variable
-        if (repX.kind != Expr::VarNode)
-        {
-            smt::Term andarg = slv->make_term(smt::Equal, node(slv, repE), slv->make_term(sym, slv->make_sort(smt::INT)));
-            andargs.push_back(andarg);
-            for (int i = repX.args.size(); i != arity(x->get_sort()); i++)
-            {
-                andargs.push_back(test(slv, getarg(slv, repE, i), "None"));
-            }
-        }
+    // Eq constraint on all other members of each equivalence class
+    for (auto &&s : pat.same)
+        andargs.push_back(slv->make_term(smt::Equal, subs.at(s.path), subs.at(s.rep)));
 
-        // Eq constraint on all other members of eq class
-        for (auto &&e : v)
-        {
-            if (e != rep)
-            {
-                smt::Term e_ = subterm(slv, x, e);
-                andargs.push_back(slv->make_term(smt::Equal, e_, repE));
-            }
-        }
+    // A variable bound twice (with differently written sorts) binds one thing
+    for (auto &&b : pat.binds)
+    {
+        if (b.prev >= 0)
+            andargs.push_back(slv->make_term(smt::Equal, subs.at(b.path), subs.at(pat.binds.at(b.prev).path)));
     }
 
-    smt::Term ret = slv->make_term(smt::And, andargs);
-    return ret;
+    return count(slv->make_term(smt::And, andargs));
 }
 
 smt::Term rterm_fun(const smt::SmtSolver &slv,
@@ -120,30 +140,43 @@ smt::Term rterm_fun(const smt::SmtSolver &slv,
                     const smt::Term &x,
                     const smt::Term &step,
                     const int &ruleind,
-                    const std::string &dir)
+                    const std::string &dir,
+                    Subterms *xs)
 {
-    Rule rule = thry.rules.at(ruleind - 1);
-    Expr src = dir == "f" ? rule.t1 : rule.t2;
-    Expr tar = dir == "f" ? rule.t2 : rule.t1;
-
-    // Get hash for each node
-    std::map<Vi, size_t> srchash = src.gethash(), tarhash = tar.gethash();
-    std::map<size_t, Vi> srchashrev;
-    for (auto &&[k, v] : Expr::distinct(srchash))
-        srchashrev[k] = v.front();
+    Subterms local(slv, x);
+    Subterms &subs = xs ? *xs : local;
+    const Pattern &pat = thry.program(ruleind, dir == "f");
 
     // Construct target in CVC4, making reference to source when possible
-
-    //std::cout << "Calling construct with tar" << tar << " and src " << src << std::endl;
-    smt::Term res = construct(slv, x->get_sort(), thry, tar, src, x, step);
-    return res;
+    Vt stack;
+    for (auto &&b : pat.plan)
+    {
+        if (b.op == Pattern::Build::Copy)
+        {
+            stack.push_back(subs.at(b.path));
+            continue;
+        }
+        Vt args(stack.end() - b.nargs, stack.end());
+        stack.resize(stack.size() - b.nargs);
+        // Same numbering as construct()
+        smt::Term n;
+        if (b.op == Pattern::Build::Fresh)
+            n = mkfresh(slv, x->get_sort(), step, b.code);
+        else
+            n = b.code ? numeral(slv, b.code, nodesort(slv, x->get_sort())) : mknode(slv, x->get_sort(), thry, b.sym);
+        stack.push_back(ast(slv, x->get_sort(), n, args));
+    }
+    return stack.back();
 }
 
 smt::Term getAt(const smt::SmtSolver &slv,
                 const smt::Term &xTerm,
                 const smt::Term &pTerm,
-                const Vvvi &paths)
+                const Vvvi &paths,
+                Subterms *xs)
 {
+    Subterms local(slv, xTerm);
+    Subterms &subs = xs ? *xs : local;
     smt::Term err = unit(slv, xTerm->get_sort(), "Error");
     Vt pathConds{ntest(slv, xTerm, "ast"),
                  test(slv, pTerm, "Empty")};
@@ -153,7 +186,7 @@ smt::Term getAt(const smt::SmtSolver &slv,
         for (auto &&p : ps)
         {
             pathConds.push_back(test(slv, pTerm, "P" + join(p)));
-            getAtThens.push_back(subterm(slv, xTerm, p));
+            getAtThens.push_back(subs.at(p));
         }
     }
     return ITE(slv, pathConds, getAtThens, err);
@@ -163,8 +196,11 @@ smt::Term replaceAt(const smt::SmtSolver &slv,
                     const smt::Term &xTerm,
                     const smt::Term &yTerm,
                     const smt::Term &pTerm,
-                    const Vvvi &paths)
+                    const Vvvi &paths,
+                    Subterms *xs)
 {
+    Subterms local(slv, xTerm);
+    Subterms &subs = xs ? *xs : local;
     smt::Term err = unit(slv, xTerm->get_sort(), "Error");
 
     Vt pathConds{ntest(slv, xTerm, "ast"), test(slv, pTerm, "Empty")};
@@ -174,29 +210,168 @@ smt::Term replaceAt(const smt::SmtSolver &slv,
         for (auto &&p : ps)
         {
             pathConds.push_back(test(slv, pTerm, "P" + join(p)));
-            replaceAtThens.push_back(replP_fun(slv, xTerm, yTerm, p));
+            replaceAtThens.push_back(replP_fun(slv, xTerm, yTerm, p, &subs));
         }
     }
     return ITE(slv, pathConds, replaceAtThens, err);
 }
 
+// Apply a selector of the Levels path constructor
+static smt::Term pathsel(const smt::SmtSolver &slv,
+                         const smt::Term &pTerm,
+                         const std::string &name)
+{
+    Handles *h = Handles::current(slv);
+    smt::Term s = h ? h->selector(pTerm->get_sort(), "path", name)
+                    : slv->get_selector(pTerm->get_sort(), "path", name);
+    return slv->make_term(smt::Apply_Selector, s, pTerm);
+}
+
+// Max length of a path of the Levels encoding
+static int pathdepth(const smt::Sort &pathSort)
+{
+    // -1 because "len" is also one of the selectors
+    return pathSort->get_datatype()->get_num_selectors("path") - 1;
+}
+
+smt::Term mkPath(const smt::SmtSolver &slv,
+                 const smt::Sort &pathSort,
+                 const Vi &p)
+{
+    smt::Sort Int = intsort(slv);
+    Vt args{slv->get_constructor(pathSort, "path"), numeral(slv, p.size(), Int)};
+    for (int i = 0; i != pathdepth(pathSort); i++)
+        args.push_back(numeral(slv, i < p.size() ? p.at(i) : 0, Int));
+    return slv->make_term(smt::Apply_Constructor, args);
+}
+
+smt::Term validPath(const smt::SmtSolver &slv,
+                    const smt::Term &pTerm,
+                    const int &arity)
+{
+    smt::Sort Int = intsort(slv);
+    smt::Term zero = numeral(slv, 0, Int);
+    smt::Term len = pathsel(slv, pTerm, "len");
+    const int depth = pathdepth(pTerm->get_sort());
+
+    Vt conds{slv->make_term(smt::Ge, len, zero),
+             slv->make_term(smt::Le, len, numeral(slv, depth, Int))};
+    for (int k = 1; k <= depth; k++)
+    {
+        smt::Term c = pathsel(slv, pTerm, "c" + std::to_string(k));
+        smt::Term inpath = slv->make_term(smt::Ge, len, numeral(slv, k, Int));
+        smt::Term inrange = slv->make_term(smt::And,
+                                           slv->make_term(smt::Ge, c, zero),
+                                           slv->make_term(smt::Lt, c, numeral(slv, arity, Int)));
+        conds.push_back(slv->make_term(smt::Ite, inpath, inrange, slv->make_term(smt::Equal, c, zero)));
+    }
+    return slv->make_term(smt::And, conds);
+}
+
+// The subterm of x at each level of the path p (Error for an invalid child
+// index, or one which reach rules out)
+static Vt levels(const smt::SmtSolver &slv,
+                 const smt::Term &x,
+                 const smt::Term &p,
+                 const Reach *reach = nullptr)
+{
+    smt::Sort Int = intsort(slv);
+    smt::Term err = unit(slv, x->get_sort(), "Error");
+    const int n = arity(slv, x->get_sort());
+    Vt res{x};
+    for (int k = 1; k <= pathdepth(p->get_sort()); k++)
+    {
+        smt::Term c = pathsel(slv, p, "c" + std::to_string(k));
+        Vt ifs, thens;
+        for (int j = 0; j != n; j++)
+        {
+            if (reach && !reach->child(k, j))
+                continue;
+            ifs.push_back(slv->make_term(smt::Equal, c, numeral(slv, j, Int)));
+            thens.push_back(getarg(slv, res.back(), j));
+        }
+        res.push_back(ITE(slv, ifs, thens, err));
+    }
+    return res;
+}
+
+smt::Term getAtLevels(const smt::SmtSolver &slv,
+                      const smt::Term &xTerm,
+                      const smt::Term &pTerm,
+                      const Reach *reach)
+{
+    smt::Sort Int = intsort(slv);
+    smt::Term err = unit(slv, xTerm->get_sort(), "Error");
+    smt::Term len = pathsel(slv, pTerm, "len");
+    Vt subs = levels(slv, xTerm, pTerm, reach);
+
+    Vt conds{ntest(slv, xTerm, "ast"), slv->make_term(smt::Not, validPath(slv, pTerm, arity(slv, xTerm->get_sort())))};
+    Vt thens{err, err};
+    for (int k = 0; k != subs.size(); k++)
+    {
+        conds.push_back(slv->make_term(smt::Equal, len, numeral(slv, k, Int)));
+        thens.push_back(subs.at(k));
+    }
+    return ITE(slv, conds, thens, err);
+}
+
+smt::Term replaceAtLevels(const smt::SmtSolver &slv,
+                          const smt::Term &xTerm,
+                          const smt::Term &yTerm,
+                          const smt::Term &pTerm)
+{
+    smt::Sort Int = intsort(slv);
+    smt::Sort astSort = xTerm->get_sort();
+    smt::Term err = unit(slv, astSort, "Error");
+    smt::Term len = pathsel(slv, pTerm, "len");
+    const int n = arity(slv, astSort);
+    Vt subs = levels(slv, xTerm, pTerm);
+
+    // Replacement of the subterm at each level, from the deepest one up
+    smt::Term result = yTerm;
+    for (int k = subs.size() - 2; k >= 0; k--)
+    {
+        smt::Term c = pathsel(slv, pTerm, "c" + std::to_string(k + 1));
+        Vt newargs;
+        for (int j = 0; j != n; j++)
+            newargs.push_back(slv->make_term(smt::Ite,
+                                             slv->make_term(smt::Equal, c, numeral(slv, j, Int)),
+                                             result,
+                                             getarg(slv, subs.at(k), j)));
+        smt::Term replaced = ast(slv, astSort, node(slv, subs.at(k)), newargs);
+        result = slv->make_term(smt::Ite,
+                                slv->make_term(smt::Equal, len, numeral(slv, k, Int)),
+                                yTerm,
+                                replaced);
+    }
+    Vt conds{ntest(slv, xTerm, "ast"), slv->make_term(smt::Not, validPath(slv, pTerm, n))};
+    return ITE(slv, conds, {err, err}, result);
+}
+
 smt::Term rewriteTop(const smt::SmtSolver &slv,
                      const smt::Term &x,
                      const smt::Term &rTerm,
                      const Theory &t,
-                     const smt::Term &step)
+                     const smt::Term &step,
+                     const Reach *reach,
+                     const Vt &guards)
 {
     Vt ruleConds{ntest(slv, x, "ast")}, ruleThens{unit(slv, x->get_sort(), "Error")};
-    std::map<std::string, int> syms = t.symcode();
+    Subterms xs(slv, x); // shared by every rule
     for (int i = 1; i <= t.rules.size(); i++)
     {
         for (auto &&ch : {"f", "r"})
         {
-            smt::Term req = test(slv, rTerm, "R" + std::to_string(i) + ch);
+            const bool forward = ch[0] == 'f';
+            if (reach && !reach->fires(i, forward))
+                continue;
+            smt::Term req = isrule(slv, rTerm, i, forward);
+            if (!guards.empty() && guards.at(2 * (i - 1) + (forward ? 0 : 1)))
+                req = slv->make_term(smt::And, req, guards.at(2 * (i - 1) + (forward ? 0 : 1)));
             //std::cout << "making pat" << i << ch << std::endl;
-            smt::Term rpat = pat_fun(slv, t, x, i, ch);
+            smt::Term rpat = pat_fun(slv, t, x, i, ch, &xs);
             //std::cout << "making term" <<  i << ch << std::endl;
-            smt::Term rt = rterm_fun(slv, t, x, step, i, ch);
+            smt::Term rt = rterm_fun(slv, t, x, step, i, ch, &xs);
             ruleConds.push_back(slv->make_term(smt::And, req, rpat));
             ruleThens.push_back(rt);
         }
@@ -205,20 +380,181 @@ smt::Term rewriteTop(const smt::SmtSolver &slv,
     return ITE(slv, ruleConds, ruleThens, unit(slv, x->get_sort(), "Error"));
 }
 
+// Disjunction (false if empty)
+static smt::Term any(const smt::SmtSolver &slv, const Vt &ts)
+{
+    if (ts.empty())
+        return slv->make_term(false);
+    return ts.size() == 1 ? ts.front() : slv->make_term(smt::Or, ts);
+}
+
 smt::Term rewrite(const smt::SmtSolver &slv,
                   const Theory &t,
                   const smt::Term &x,
                   const smt::Term &r,
                   const smt::Term &p,
                   const smt::Term &step,
-                  const int &depth)
+                  const int &depth,
+                  const Encoding &enc)
 {
+    TermCount count("rewrite");
+    const Reach *reach = enc.reach.get();
+    smt::Sort Int = intsort(slv);
+    Vt guards; // where each rule direction may apply, if not everywhere
+
+    if (enc.paths == Encoding::Levels)
+    {
+        for (int i = 1; reach && i <= t.rules.size(); i++)
+        {
+            for (auto &&forward : {true, false})
+            {
+                Vt lens;
+                for (int k = 0; k <= depth && !reach->everywhere(i, forward); k++)
+                {
+                    if (reach->fires(i, forward, k))
+                        lens.push_back(slv->make_term(smt::Equal, pathsel(slv, p, "len"), numeral(slv, k, Int)));
+                }
+                guards.push_back(lens.empty() ? nullptr : any(slv, lens));
+            }
+        }
+        smt::Term presub = getAtLevels(slv, x, p, reach);
+        smt::Term subbed = rewriteTop(slv, presub, r, t, step, reach, guards);
+        return count(replaceAtLevels(slv, x, subbed, p));
+    }
+
     Vvvi paths = all_paths(depth, t.max_arity());
+    if (reach)
+    {
+        // Only the paths where something may be rewritten, and each rule
+        // direction only at the paths where it may apply
+        Vvi useful{{}};
+        Vt tests{test(slv, p, "Empty")};
+        for (auto &&ps : paths)
+        {
+            Vvi kept;
+            for (auto &&q : ps)
+            {
+                if (!reach->useful(q))
+                    continue;
+                kept.push_back(q);
+                useful.push_back(q);
+                tests.push_back(test(slv, p, "P" + join(q)));
+            }
+            ps = kept;
+        }
+        for (int i = 1; i <= t.rules.size(); i++)
+        {
+            for (auto &&forward : {true, false})
+            {
+                Vt at;
+                for (int j = 0; j != useful.size(); j++)
+                {
+                    if (reach->fires_at(i, forward, useful.at(j)))
+                        at.push_back(tests.at(j));
+                }
+                guards.push_back(at.size() == tests.size() ? nullptr : any(slv, at));
+            }
+        }
+    }
+
+    Subterms xs(slv, x); // each path's chain of selectors is built once
+    smt::Term presub = getAt(slv, x, p, paths, &xs);
+    smt::Term subbed = rewriteTop(slv, presub, r, t, step, reach, guards);
+    smt::Term ret = replaceAt(slv, x, subbed, p, paths, &xs);
 
-    smt::Term presub = getAt(slv, x, p, paths);
-    smt::Term subbed = rewriteTop(slv, presub, r, t, step);
-    smt::Term ret = replaceAt(slv, x, subbed, p, paths);
+    return count(slv->make_term(smt::Ite, ntest(slv, x, "ast"),
+                                unit(slv, x->get_sort(), "Error"), ret));
+}
 
-    return slv->make_term(smt::Ite, ntest(slv, x, "ast"),
-                          unit(slv, x->get_sort(), "Error"), ret);
+// Whether a path (of either encoding) is disjoint from another one, and
+// before it: at the first level where they differ, its child index is smaller
+static smt::Term before(const smt::SmtSolver &slv,
+                        const smt::Term &pTerm,
+                        const smt::Term &prevP,
+                        const int &depth,
+                        const int &arity,
+                        const Encoding &enc)
+{
+    Vt conds;
+    if (enc.paths == Encoding::Levels)
+    {
+        smt::Sort Int = intsort(slv);
+        Vt same;
+        for (int k = 1; k <= depth; k++)
+        {
+            smt::Term k_ = numeral(slv, k, Int);
+            smt::Term c = pathsel(slv, pTerm, "c" + std::to_string(k));
+            smt::Term prevc = pathsel(slv, prevP, "c" + std::to_string(k));
+            Vt conj = same;
+            conj.push_back(slv->make_term(smt::Ge, pathsel(slv, pTerm, "len"), k_));
+            conj.push_back(slv->make_term(smt::Ge, pathsel(slv, prevP, "len"), k_));
+            conj.push_back(slv->make_term(smt::Lt, c, prevc));
+            conds.push_back(slv->make_term(smt::And, conj));
+            same.push_back(slv->make_term(smt::Equal, c, prevc));
+        }
+        return any(slv, conds);
+    }
+
+    // Which paths start with each prefix
+    std::map<Vi, Vt> under, prevUnder;
+    for (auto &&ps : all_paths(depth, arity))
+    {
+        for (auto &&q : ps)
+        {
+            for (size_t k = 1; k <= q.size(); k++)
+            {
+                under[Vi(q.begin(), q.begin() + k)].push_back(test(slv, pTerm, "P" + join(q)));
+                prevUnder[Vi(q.begin(), q.begin() + k)].push_back(test(slv, prevP, "P" + join(q)));
+            }
+        }
+    }
+    for (auto &&[u, ts] : under)
+    {
+        for (int a = u.back() + 1; a <= arity; a++)
+        {
+            Vi v = u;
+            v.back() = a;
+            if (prevUnder.count(v))
+                conds.push_back(slv->make_term(smt::And, any(slv, ts), any(slv, prevUnder.at(v))));
+        }
+    }
+    return any(slv, conds);
+}
+
+smt::Term redundant(const smt::SmtSolver &slv,
+                    const Theory &t,
+                    const smt::Term &x,
+                    const smt::Term &y,
+                    const smt::Term &r,
+                    const smt::Term &p,
+                    const smt::Term &prevR,
+                    const smt::Term &prevP,
+                    const int &depth,
+                    const Encoding &enc)
+{
+    // Only rule directions which introduce no variables can be undone, or
+    // moved to another step, without changing the result
+    Vt inverse, moves, prevMoves;
+    for (int i = 1; i <= t.rules.size(); i++)
+    {
+        if (t.program(i, true).fresh || t.program(i, false).fresh)
+            continue;
+        for (auto &&forward : {true, false})
+        {
+            inverse.push_back(slv->make_term(smt::And, isrule(slv, prevR, i, forward), isrule(slv, r, i, !forward)));
+            moves.push_back(isrule(slv, r, i, forward));
+            prevMoves.push_back(isrule(slv, prevR, i, forward));
+        }
+    }
+
+    Vt conds{slv->make_term(smt::Equal, x, y)};
+    if (!inverse.empty())
+    {
+        conds.push_back(slv->make_term(smt::And, slv->make_term(smt::Equal, p, prevP), any(slv, inverse)));
+        conds.push_back(slv->make_term(smt::And,
+                                       {any(slv, moves),
+                                        any(slv, prevMoves),
+                                        before(slv, p, prevP, depth, t.max_arity(), enc)}));
+    }
+    return any(slv, conds);
 }
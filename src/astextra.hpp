@@ -7,6 +7,7 @@
 
 #include <vector>
 #include "astextra_basic.hpp"
+#include "encoding.hpp"
 #include "smt-switch/smt.h"
 typedef std::map<int, smt::Term> Tmap;
 typedef std::vector<Rule> Vr;
@@ -34,12 +35,14 @@ bool check_equal(smt::SmtSolver &slv,
  * @param solver
  * @param t - Theory dictates the arity of AST and the # of rules
  * @param depth - Arity + depth determines the possible paths
- * @return - the three sorts
+ * @param enc - How paths, node symbols and rules are represented
+ * @return - the three sorts (the Rule "sort" is a bit-vector with Encoding::BitVectors)
  */
 std::tuple<smt::Sort, smt::Sort, smt::Sort> create_datatypes(
     smt::SmtSolver &slv,
     const Theory &t,
-    const int &depth);
+    const int &depth,
+    const Encoding &enc = {});
 
 /**
  * Evaluate whether a term satisfies the input pattern of a rewrite rule.
@@ -49,13 +52,15 @@ std::tuple<smt::Sort, smt::Sort, smt::Sort> create_datatypes(
  * @param x - A term we are testing
  * @param r - Index to which rule we are talking about
  * @param dir - Forward or reverse direction?
+ * @param xs - Subterms of x to reuse (if null, only used for this call)
  * @return A CVC term which evalutes to a bool
  */
 smt::Term pat_fun(const smt::SmtSolver &slv,
                   const Theory &thry,
                   const smt::Term &x,
                   const int &r,
-                  const std::string &dir);
+                  const std::string &dir,
+                  Subterms *xs = nullptr);
 
 /**
  * Construct the resulting term of a rewrite in the context of a term which matches the input pattern.
@@ -66,6 +71,7 @@ smt::Term pat_fun(const smt::SmtSolver &slv,
  * @param step - which rewrite step we are on (needed to make variables introduced distinct)
  * @param ruleind - Index to which rule we are talking about
  * @param dir - Forward or reverse direction?
+ * @param xs - Subterms of x to reuse (if null, only used for this call)
  * @return A CVC term which matches the result pattern
  */
 smt::Term rterm_fun(const smt::SmtSolver &slv,
@@ -73,7 +79,8 @@ smt::Term rterm_fun(const smt::SmtSolver &slv,
                     const smt::Term &x,
                     const smt::Term &step,
                     const int &ruleind,
-                    const std::string &dir);
+                    const std::string &dir,
+                    Subterms *xs = nullptr);
 
 /**
  * Access a subterm via a path CVC term.
@@ -82,13 +89,15 @@ smt::Term rterm_fun(const smt::SmtSolver &slv,
  * @param xTerm - term from which we wish to look at a subterm
  * @param pTerm - CVC4 term which refers to some path
  * @param paths - All possible paths
+ * @param xs - Subterms of xTerm to reuse (if null, only used for this call)
  * @return a CVC4 subterm of xTerm
  */
 
 smt::Term getAt(const smt::SmtSolver &slv,
                 const smt::Term &xTerm,
                 const smt::Term &pTerm,
-                const Vvvi &paths);
+                const Vvvi &paths,
+                Subterms *xs = nullptr);
 /**
  * Access a subterm via a path CVC term.
  *
@@ -97,6 +106,7 @@ smt::Term getAt(const smt::SmtSolver &slv,
  * @param yTerm - term to insert into xTerm
  * @param pTerm - CVC4 term which refers to some path to the location of insertino
  * @param paths - All possible paths
+ * @param xs - Subterms of xTerm to reuse (if null, only used for this call)
  * @return Result of subtitution.
  */
 
@@ -104,7 +114,62 @@ smt::Term replaceAt(const smt::SmtSolver &slv,
                     const smt::Term &xTerm,
                     const smt::Term &yTerm,
                     const smt::Term &pTerm,
-                    const Vvvi &paths);
+                    const Vvvi &paths,
+                    Subterms *xs = nullptr);
+
+/**
+ * Construct a path of the Levels encoding
+ *
+ * @param slv - solver
+ * @param pathSort - Path sort from create_datatypes() with Encoding::Levels
+ * @param p - e.g. [2,1]
+ * @return the Path term, e.g. (path 2 2 1 0) at depth 3
+ */
+smt::Term mkPath(const smt::SmtSolver &slv,
+                 const smt::Sort &pathSort,
+                 const Vi &p);
+
+/**
+ * Whether a path of the Levels encoding is well formed: its length is at
+ * most the depth, it has a valid child index at each of its levels and
+ * zeros after them (so that each path has one representation)
+ *
+ * @param slv - solver
+ * @param pTerm - Path term (Levels encoding)
+ * @param arity - Number of children of an AST node
+ * @return A CVC term which evalutes to a bool
+ */
+smt::Term validPath(const smt::SmtSolver &slv,
+                    const smt::Term &pTerm,
+                    const int &arity);
+
+/**
+ * getAt for the Levels encoding: descend one level at a time
+ *
+ * @param solver
+ * @param xTerm - term from which we wish to look at a subterm
+ * @param pTerm - Path term (Levels encoding)
+ * @param reach - If given, only the arguments it allows are descended into
+ * @return a CVC4 subterm of xTerm (Error if the path is not valid)
+ */
+smt::Term getAtLevels(const smt::SmtSolver &slv,
+                      const smt::Term &xTerm,
+                      const smt::Term &pTerm,
+                      const Reach *reach = nullptr);
+
+/**
+ * replaceAt for the Levels encoding: rebuild one level at a time, from the deepest one up
+ *
+ * @param solver
+ * @param xTerm - term from which we wish to substitute in
+ * @param yTerm - term to insert into xTerm
+ * @param pTerm - Path term (Levels encoding)
+ * @return Result of subtitution (Error if the path is not valid)
+ */
+smt::Term replaceAtLevels(const smt::SmtSolver &slv,
+                          const smt::Term &xTerm,
+                          const smt::Term &yTerm,
+                          const smt::Term &pTerm);
 
 /**
  * Apply rewrite rule to a top-level term
@@ -114,13 +179,18 @@ smt::Term replaceAt(const smt::SmtSolver &slv,
  * @param rTerm - a CVC term of sort Rule
  * @param t - Theory of which x is a term
  * @param step - Which rewrite step we are on (needed to make variables introduced distinct)
+ * @param reach - If given, the rule directions it rules out are left out
+ * @param guards - If given, for each rule direction (R1f, R1r, R2f...) a condition
+ *                 on the path under which it may apply (null for none)
  * @param returns - Either Error or the substitution result
 */
 smt::Term rewriteTop(const smt::SmtSolver &slv,
                      const smt::Term &x,
                      const smt::Term &rTerm,
                      const Theory &t,
-                     const smt::Term &step);
+                     const smt::Term &step,
+                     const Reach *reach = nullptr,
+                     const Vt &guards = {});
 /**
  * ASSERT that t1 can be rewritten into t2 in (exactly) some number of rewrites.
  *
@@ -129,6 +199,8 @@ smt::Term rewriteTop(const smt::SmtSolver &slv,
  * @param r - variable for the rule applied
  * @param p - variable for the subterm rule is applied to
  * @param steps - Which rewrite step we are on
+ * @param enc - Encoding the sorts were created with (and analysis of the query
+ *              to prune it with, if any)
  */
 smt::Term rewrite(const smt::SmtSolver &slv,
                   const Theory &t,
@@ -136,5 +208,39 @@ smt::Term rewrite(const smt::SmtSolver &slv,
                   const smt::Term &r,
                   const smt::Term &p,
                   const smt::Term &step,
-                  const int &depth);
-#endif
\ No newline at end of file
+                  const int &depth,
+                  const Encoding &enc = {});
+
+/**
+ * Whether a rewrite step only repeats or reorders what shorter (or otherwise
+ * ordered) sequences of steps already do, so that a search can leave it out:
+ * - it does not change the term,
+ * - it undoes the previous step (same rule, other direction, same path), or
+ * - it is at a path disjoint from the previous step's, and before it, so the
+ *   two steps commute and the other order is searched instead.
+ * Only rules which introduce no variables are undone or reordered, as the
+ * variables they introduce depend on the step.
+ *
+ * @param solver
+ * @param t - Theory
+ * @param x - Term before the step
+ * @param y - Term after the step
+ * @param r - Rule of the step
+ * @param p - Path of the step
+ * @param prevR - Rule of the previous step
+ * @param prevP - Path of the previous step
+ * @param depth - Max length of a path
+ * @param enc - Encoding the sorts were created with
+ * @return A CVC term which evalutes to a bool
+ */
+smt::Term redundant(const smt::SmtSolver &slv,
+                    const Theory &t,
+                    const smt::Term &x,
+                    const smt::Term &y,
+                    const smt::Term &r,
+                    const smt::Term &p,
+                    const smt::Term &prevR,
+                    const smt::Term &prevP,
+                    const int &depth,
+                    const Encoding &enc = {});
+#endif
@@ -1,4 +1,6 @@
 #include "astextra_basic.hpp"
+#include "cvc4extra.hpp"
+#include "rewrite.hpp"
 
 /**
  * Helper functions for astextra.hpp
@@ -51,15 +53,119 @@ Vvvi all_paths(const int &depth, const int &arity)
     return res;
 }
 
+// Active Handles of each thread
+static thread_local Handles *active = nullptr;
+
+Handles::Handles(const smt::SmtSolver &slv) : slv(slv), Int(slv->make_sort(smt::INT)) {}
+
+Handles::Use::Use(Handles &h) : prev(active)
+{
+    active = &h;
+}
+
+Handles::Use::~Use()
+{
+    active = prev;
+}
+
+Handles *Handles::current(const smt::SmtSolver &slv)
+{
+    return active && active->slv == slv ? active : nullptr;
+}
+
+const smt::Sort &Handles::integers()
+{
+    return Int;
+}
+
+const Vt &Handles::args(const smt::Sort &astSort)
+{
+    Vt &res = tables[astSort].args;
+    if (res.empty())
+    {
+        // -1 because "node" is also one of the selectors
+        const int n = astSort->get_datatype()->get_num_selectors("ast") - 1;
+        for (int i = 0; i != n; i++)
+            res.push_back(slv->get_selector(astSort, "ast", "a" + std::to_string(i)));
+    }
+    return res;
+}
+
+const smt::Sort &Handles::nodes(const smt::Sort &astSort)
+{
+    smt::Sort &res = tables[astSort].nodes;
+    if (!res)
+        res = slv->make_term(smt::Apply_Selector, selector(astSort, "ast", "node"), unit(astSort, "None"))->get_sort();
+    return res;
+}
+
+const smt::Term &Handles::selector(const smt::Sort &srt, const std::string &cons, const std::string &name)
+{
+    smt::Term &res = tables[srt].selectors[cons + " " + name];
+    if (!res)
+        res = slv->get_selector(srt, cons, name);
+    return res;
+}
+
+const smt::Term &Handles::constructor(const smt::Sort &srt, const std::string &name)
+{
+    smt::Term &res = tables[srt].constructors[name];
+    if (!res)
+        res = slv->get_constructor(srt, name);
+    return res;
+}
+
+const smt::Term &Handles::tester(const smt::Sort &srt, const std::string &name)
+{
+    smt::Term &res = tables[srt].testers[name];
+    if (!res)
+        res = slv->get_tester(srt, name);
+    return res;
+}
+
+const smt::Term &Handles::unit(const smt::Sort &srt, const std::string &name)
+{
+    smt::Term &res = tables[srt].units[name];
+    if (!res)
+        res = slv->make_term(smt::Apply_Constructor, constructor(srt, name));
+    return res;
+}
+
+const smt::Term &Handles::numeral(const int64_t &v, const smt::Sort &srt)
+{
+    smt::Term &res = tables[srt].numerals[v];
+    if (!res)
+        res = slv->make_term(v, srt);
+    return res;
+}
+
+smt::Sort intsort(const smt::SmtSolver &slv)
+{
+    if (Handles *h = Handles::current(slv))
+        return h->integers();
+    return slv->make_sort(smt::INT);
+}
+
+smt::Term numeral(const smt::SmtSolver &slv, const int64_t &v, const smt::Sort &srt)
+{
+    if (Handles *h = Handles::current(slv))
+        return h->numeral(v, srt);
+    return slv->make_term(v, srt);
+}
+
 smt::Term unit(const smt::SmtSolver &slv,
                const smt::Sort &srt,
                const std::string &name)
 {
+    if (Handles *h = Handles::current(slv))
+        return h->unit(srt, name);
     return slv->make_term(smt::Apply_Constructor, slv->get_constructor(srt, name));
 }
 
-int arity(const smt::Sort &astSort)
+int arity(const smt::SmtSolver &slv, const smt::Sort &astSort)
 {
+    if (Handles *h = Handles::current(slv))
+        return h->args(astSort).size();
     // -1 because "node" is also one of the selectors
     return astSort->get_datatype()->get_num_selectors("ast") - 1;
 }
@@ -67,8 +173,9 @@ int arity(const smt::Sort &astSort)
 smt::Term node(const smt::SmtSolver &slv,
                const smt::Term &x)
 {
-    smt::Term s = slv->get_selector(
-        x->get_sort(), "ast", "node");
+    Handles *h = Handles::current(slv);
+    smt::Term s = h ? h->selector(x->get_sort(), "ast", "node")
+                    : slv->get_selector(x->get_sort(), "ast", "node");
     return slv->make_term(smt::Apply_Selector, s, x);
 }
 
@@ -76,8 +183,9 @@ smt::Term getarg(const smt::SmtSolver &slv,
                  const smt::Term &x,
                  const int &i)
 {
-    smt::Term s = slv->get_selector(
-        x->get_sort(), "ast", "a" + std::to_string(i));
+    Handles *h = Handles::current(slv);
+    smt::Term s = h ? h->args(x->get_sort()).at(i)
+                    : slv->get_selector(x->get_sort(), "ast", "a" + std::to_string(i));
     return slv->make_term(smt::Apply_Selector, s, x);
 }
 
@@ -86,8 +194,11 @@ smt::Term ast(const smt::SmtSolver &slv,
               const smt::Term &n,
               const Vt &xs)
 {
+    TermCount count("ast");
+
     // First arg is the AST constructor
-    Vt args{slv->get_constructor(astSort, "ast"), n};
+    Handles *h = Handles::current(slv);
+    Vt args{h ? h->constructor(astSort, "ast") : slv->get_constructor(astSort, "ast"), n};
 
     // Vector of booleans to be joined with OR
     Vt conds;
@@ -117,12 +228,12 @@ smt::Term ast(const smt::SmtSolver &slv,
     // args, need to pad with 2 Nones)
     smt::Term nt = unit(slv, astSort, "None");
 
-    for (int i = 0; i != arity(astSort) - xs.size(); i++)
+    for (int i = 0; i != arity(slv, astSort) - xs.size(); i++)
         args.push_back(nt);
 
     // create AST term iff none of the args are errors
     smt::Term ret = slv->make_term(smt::Apply_Constructor, args);
-    return slv->make_term(smt::Ite, condition, err, ret);
+    return count(slv->make_term(smt::Ite, condition, err, ret));
 }
 
 smt::Term replace(const smt::SmtSolver &slv,
@@ -130,11 +241,12 @@ smt::Term replace(const smt::SmtSolver &slv,
                   const smt::Term &x,
                   const smt::Term &y)
 {
+    TermCount count("replace");
     Vt newargs;
     smt::Sort astSort = x->get_sort();
 
     // Replace the argument `arg` with y
-    for (int j = 0; j != arity(astSort); j++)
+    for (int j = 0; j != arity(slv, astSort); j++)
     {
         if (j == arg)
             newargs.push_back(y);
@@ -142,7 +254,7 @@ smt::Term replace(const smt::SmtSolver &slv,
             newargs.push_back(getarg(slv, x, j));
     }
     // AST with same node and updated args
-    return ast(slv, astSort, node(slv, x), newargs);
+    return count(ast(slv, astSort, node(slv, x), newargs));
 }
 
 Vi take(const Vi &vec, const size_t &n)
@@ -156,8 +268,11 @@ Vi take(const Vi &vec, const size_t &n)
 smt::Term replP_fun(const smt::SmtSolver &slv,
                     const smt::Term &x,
                     const smt::Term &y,
-                    const Vi &p)
+                    const Vi &p,
+                    Subterms *xs)
 {
+    Subterms local(slv, x);
+    Subterms &subs = xs ? *xs : local;
 
     // There is a chain of subterms of x that get replaced,
     // terminating with the overall replacement being a replacement
@@ -174,7 +289,7 @@ smt::Term replP_fun(const smt::SmtSolver &slv,
     {
         // subx is the i'th-from-last term in the chain of subterms
         // that needs a replacement
-        smt::Term subx = subterm(slv, x, take(p, i));
+        smt::Term subx = subs.at(take(p, i));
         // The i'th element of p tells which arg of `subx` needs to be replaced
         result = replace(slv, p.at(i), subx, result);
     }
@@ -185,6 +300,7 @@ smt::Term subterm(const smt::SmtSolver &slv,
                   const smt::Term &root,
                   const Vi &pth)
 {
+    TermCount count("subterm");
     smt::Term x = root;
     if (x->get_sort()->to_string() != "AST")
         throw std::runtime_error("Cannot call subterm on a non-AST");
@@ -192,7 +308,52 @@ smt::Term subterm(const smt::SmtSolver &slv,
     for (auto &&i : pth)
         x = getarg(slv, x, i);
 
-    return x;
+    return count(x);
+}
+
+Subterms::Subterms(const smt::SmtSolver &slv, const smt::Term &root) : slv(slv), nodes{{root, {}}} {}
+
+const smt::Term &Subterms::root() const
+{
+    return nodes.front().term;
+}
+
+smt::Term Subterms::at(const Vi &pth)
+{
+    TermCount count("subterm");
+    int n = 0;
+    for (auto &&i : pth)
+    {
+        auto it = nodes.at(n).next.find(i);
+        if (it != nodes.at(n).next.end())
+        {
+            n = it->second;
+            continue;
+        }
+        if (selectors.empty())
+        {
+            if (root()->get_sort()->to_string() != "AST")
+                throw std::runtime_error("Cannot call subterm on a non-AST");
+            if (Handles *h = Handles::current(slv))
+                selectors = h->args(root()->get_sort());
+            else
+            {
+                for (int j = 0; j != arity(slv, root()->get_sort()); j++)
+                    selectors.push_back(slv->get_selector(root()->get_sort(), "ast", "a" + std::to_string(j)));
+            }
+        }
+        // No reference into nodes is held here: push_back may move them
+        smt::Term x = slv->make_term(smt::Apply_Selector, selectors.at(i), nodes.at(n).term);
+        nodes.at(n).next.insert({i, nodes.size()});
+        n = nodes.size();
+        nodes.push_back({x, {}});
+    }
+    return count(nodes.at(n).term);
+}
+
+size_t Subterms::size() const
+{
+    return nodes.size();
 }
 
 int64_t strhash(const std::string &s)
@@ -225,12 +386,85 @@ std::string strhashinv(const int64_t &i)
     }
 }
 
+smt::Sort nodesort(const smt::SmtSolver &slv, const smt::Sort &astSort)
+{
+    if (Handles *h = Handles::current(slv))
+        return h->nodes(astSort);
+    return node(slv, unit(slv, astSort, "None"))->get_sort();
+}
+
+smt::Sort stepsort(const smt::SmtSolver &slv, const smt::Sort &astSort)
+{
+    smt::Sort ns = nodesort(slv, astSort);
+    if (ns->get_sort_kind() != smt::BV)
+        return ns;
+    return slv->make_sort(smt::BV, ns->get_width() - 1 - offset_bits);
+}
+
+smt::Term mknode(const smt::SmtSolver &slv,
+                 const smt::Sort &astSort,
+                 const Theory &t,
+                 const Sym &s)
+{
+    smt::Sort ns = nodesort(slv, astSort);
+    if (int code = t.code(s))
+        return numeral(slv, code, ns);
+    if (ns->get_sort_kind() != smt::BV)
+        return slv->make_term(strhash(s.str()), ns);
+
+    // The top bit is for free variables
+    const uint64_t v = t.symcode().size() + s.id();
+    if (v >> (ns->get_width() - 1))
+        throw std::runtime_error("Too many symbols for " + std::to_string(ns->get_width()) + "-bit nodes");
+    return slv->make_term(v, ns);
+}
+
+smt::Term mkfresh(const smt::SmtSolver &slv,
+                  const smt::Sort &astSort,
+                  const smt::Term &step,
+                  const int &offset)
+{
+    smt::Sort ns = nodesort(slv, astSort);
+    if (ns->get_sort_kind() != smt::BV)
+    {
+        smt::Term tenstep = slv->make_term(smt::Mult, slv->make_term(-10, ns), step);
+        return slv->make_term(smt::Plus, tenstep, slv->make_term(offset, ns));
+    }
+    if (offset >> offset_bits)
+        throw std::runtime_error("Too many free variables in a rule for bit-vector nodes");
+    smt::Term flag = slv->make_term(1, slv->make_sort(smt::BV, 1));
+    smt::Term off = slv->make_term(offset, slv->make_sort(smt::BV, offset_bits));
+    return slv->make_term(smt::Concat, slv->make_term(smt::Concat, flag, step), off);
+}
+
+Sym bvnode_sym(const Theory &t, const uint64_t &value, const int &width)
+{
+    if (value >> (width - 1))
+    {
+        const uint64_t step = (value >> offset_bits) & ((uint64_t(1) << (width - 1 - offset_bits)) - 1);
+        return freshvar(step, value & ((1 << offset_bits) - 1));
+    }
+    const uint64_t ncodes = t.symcode().size();
+    return value <= ncodes ? t.decode(value) : Sym::byid(value - ncodes);
+}
+
+smt::Term isrule(const smt::SmtSolver &slv,
+                 const smt::Term &r,
+                 const int &rule,
+                 const bool &forward)
+{
+    if (r->get_sort()->get_sort_kind() == smt::BV)
+        return slv->make_term(smt::Equal, r, numeral(slv, 2 * (rule - 1) + (forward ? 0 : 1), r->get_sort()));
+    return test(slv, r, "R" + std::to_string(rule) + (forward ? "f" : "r"));
+}
+
 smt::Term test(const smt::SmtSolver &slv,
                const smt::Term &x,
                const std::string &s)
 {
+    Handles *h = Handles::current(slv);
     return slv->make_term(
-        smt::Apply_Tester, slv->get_tester(x->get_sort(), s), x);
+        smt::Apply_Tester, h ? h->tester(x->get_sort(), s) : slv->get_tester(x->get_sort(), s), x);
 }
 
 smt::Term ntest(const smt::SmtSolver &slv,
@@ -248,68 +482,47 @@ smt::Term construct(const smt::SmtSolver &slv,
                     const smt::Term &src_t,
                     const smt::Term &step)
 {
+    TermCount count("construct");
+    smt::Term step2 = (step != NULL) ? step : slv->make_term(0, stepsort(slv, astSort));
 
-    smt::Term step2 = (step != NULL) ? step : slv->make_term(0, slv->make_sort(smt::INT));
-
-    std::map<Vi, size_t> srchash, tarh = tar.gethash();
-    std::map<std::string, int> fv;
-    std::map<size_t, Vi> srch;
+    std::map<Sym, int> fv;
+    std::map<Hash128, Vi> srch;
     if (src.sym != "?")
     {
-        srchash = src.gethash();
         fv = tar.freevar(src);
+        for (auto &&[k, v] : Expr::distinct(src.positions()))
+            srch[k] = v.front(); // one representative path per distinct subterm
     }
-    for (auto &&[k, v] : Expr::distinct(srchash))
-        srch[k] = v.front(); //reverse
-    std::map<std::string, int> syms = t.symcode();
 
-    return constructRec(slv, astSort, tar, {}, src_t, srch, tarh, step2, fv, syms);
+    Subterms subs(slv, src_t);
+    return count(constructRec(slv, astSort, t, tar, subs, srch, step2, fv));
 }
 
 smt::Term constructRec(const smt::SmtSolver &slv,
                        const smt::Sort &astSort,
+                       const Theory &t,
                        const Expr &tar,
-                       const Vi &currpth,
-                       const smt::Term &src_t,
-                       const std::map<size_t, Vi> &srchsh,
-                       const std::map<Vi, size_t> &tarhsh,
+                       Subterms &src,
+                       const std::map<Hash128, Vi> &srchsh,
                        const smt::Term &step,
-                       const std::map<std::string, int> fv,
-                       const std::map<std::string, int> &syms)
+                       const std::map<Sym, int> &fv)
 {
 
-    size_t currhsh = tarhsh.at(currpth);
-    smt::Sort Int = slv->make_sort(smt::INT);
-    if (srchsh.find(currhsh) != srchsh.end())
-        return subterm(slv, src_t, srchsh.at(currhsh));
+    auto src_pth = srchsh.find(tar.hash());
+    if (src_pth != srchsh.end())
+        return src.at(src_pth->second);
     else
     {
         smt::Term node;
         if (fv.find(tar.sym) != fv.end())
-        {
-            smt::Term n10 = slv->make_term(-10, Int);
-            smt::Term tenstep = slv->make_term(smt::Mult, n10, step);
-            smt::Term offset = slv->make_term(fv.at(tar.sym), Int);
-            node = slv->make_term(smt::Plus, tenstep, offset);
-            ;
-        }
-        else if (syms.find(tar.sym) != syms.end())
-        {
-            node = slv->make_term(syms.at(tar.sym), Int);
-        }
+            node = mkfresh(slv, astSort, step, fv.at(tar.sym));
         else
-        {
-            node = slv->make_term(strhash(tar.sym), Int);
-        }
+            node = mknode(slv, astSort, t, tar.sym);
         Vt args;
         for (int i = 0; i != tar.args.size(); i++)
         {
-            Vi newpth;
-            for (auto &&j : currpth)
-                newpth.push_back(j);
-            newpth.push_back(i);
-            args.push_back(constructRec(slv, astSort, tar.args.at(i), newpth, src_t, srchsh, tarhsh,
-                                        step, fv, syms));
+            args.push_back(constructRec(slv, astSort, t, tar.args.at(i), src, srchsh,
+                                        step, fv));
         }
         return ast(slv, astSort, node, args);
     }
@@ -317,29 +530,32 @@ smt::Term constructRec(const smt::SmtSolver &slv,
 
 Expr parseCVCast(const Theory &t, std::shared_ptr<peg::Ast> ast)
 {
-    std::string sym;
     Expr::NodeType nt;
     Ve args;
-    long i = std::stol(ast->nodes.at(0)->token);
-    for (auto &&[k, v] : t.symcode())
+    std::shared_ptr<peg::Ast> n = ast->nodes.at(0);
+    Sym sym;
+    long i = 0;
+    if (n->name == "BITVEC")
+        sym = bvnode_sym(t, std::stoull(n->nodes.at(0)->token), std::stoi(n->nodes.at(1)->token));
+    else if (n->name == "BINARY")
+        sym = bvnode_sym(t, std::stoull(n->token, nullptr, 2), n->token.size());
+    else
     {
-        if (v == i)
-        {
-            sym = k;
-            if (t.ops.find(sym) != t.ops.end())
-                nt = Expr::AppNode;
-            else if (t.sorts.find(sym) != t.sorts.end())
-                nt = Expr::SortNode;
-            else
-                nt = Expr::VarNode;
-        }
+        i = std::stol(n->token);
+        sym = t.decode(i);
     }
+    if (t.ops.find(sym) != t.ops.end())
+        nt = Expr::AppNode;
+    else if (t.sorts.find(sym) != t.sorts.end())
+        nt = Expr::SortNode;
+    else
+        nt = Expr::VarNode;
     if (sym.empty())
     {
         nt = Expr::VarNode;
         sym = strhashinv(i);
     }
-    for (int i = 0; i != ast->nodes.size(); i++)
+    for (int i = 1; i != ast->nodes.size(); i++)
     {
         std::shared_ptr<peg::Ast> a = ast->nodes.at(i);
         if (a->nodes.size())
@@ -350,24 +566,35 @@ Expr parseCVCast(const Theory &t, std::shared_ptr<peg::Ast> ast)
     return {sym, nt, args};
 }
 
-Expr parseCVC(const Theory &t,
-              const std::string s)
+// Grammar of AST values printed by the solver, compiled once per process
+static const peg::parser &cvc_parser()
 {
-
-    peg::parser parser(R"(
-AST <- '(ast' NUMBER Term* ')'
+    static const peg::parser parser = [] {
+        peg::parser p(R"(
+AST <- '(ast' (BITVEC / BINARY / NUMBER) Term* ')'
 Term <- AST / 'None'
+BITVEC <- '(' '_' 'bv' NAT NAT ')'
+BINARY <- '#b' < [01]+ >
+NAT <- < [0-9]+ >
 NUMBER <- < '-'? [0-9]+ >
 %whitespace  <-  [ \t\r\n,]*
 )");
-    // PEGlib parsed the parser correctly
-    assert((bool)parser == true);
+        // PEGlib parsed the parser correctly
+        assert((bool)p == true);
+
+        p.enable_ast();
+        p.enable_packrat_parsing();
+        return p;
+    }();
+    return parser;
+}
 
-    parser.enable_ast();
-    parser.enable_packrat_parsing();
+Expr parseCVC(const Theory &t,
+              const std::string s)
+{
     std::shared_ptr<peg::Ast> ast;
 
-    if (parser.parse(s.c_str(), ast))
+    if (cvc_parser().parse(s.c_str(), ast))
     {
         return parseCVCast(t, ast);
     }
@@ -1,5 +1,7 @@
 #ifndef ASTEXTRABASIC
 #define ASTEXTRABASIC
+#include <map>
+#include <unordered_map>
 #include <vector>
 #include "smt-switch/smt.h"
 #include "theory.hpp"
@@ -42,6 +44,88 @@ Vvi paths_n(const int &depth, const int &arity);
  */
 Vvvi all_paths(const int &depth, const int &arity);
 
+/**
+ * Solver handles the encoding helpers below look up by name (sorts,
+ * datatype constructors, selectors and testers, and numerals), resolved once
+ * per solver and then handed out from tables.
+ *
+ * Create one alongside create_datatypes and activate it with a Use around
+ * the code which builds the encoding: while it is active, the helpers take
+ * their handles from it rather than asking the solver every time. Terms of
+ * another solver may still be encoded meanwhile: they bypass the tables.
+ */
+struct Handles
+{
+public:
+    Handles(const smt::SmtSolver &slv);
+
+    /**
+     * Make a Handles the active one on this thread, until destroyed (when
+     * the one which was active before is restored)
+     */
+    struct Use
+    {
+    public:
+        Use(Handles &h);
+        ~Use();
+
+    private:
+        Handles *prev;
+    };
+
+    /**
+     * @param slv Solver whose terms are being encoded
+     * @returns The active Handles of this thread if it belongs to that
+     *          solver, else null (the helpers then ask the solver directly)
+     */
+    static Handles *current(const smt::SmtSolver &slv);
+
+    const smt::Sort &integers();
+
+    // Selectors a0, a1, ... of the ast constructor of an AST sort
+    const Vt &args(const smt::Sort &astSort);
+
+    // Sort of the node selector of an AST sort
+    const smt::Sort &nodes(const smt::Sort &astSort);
+
+    const smt::Term &selector(const smt::Sort &srt, const std::string &cons, const std::string &name);
+    const smt::Term &constructor(const smt::Sort &srt, const std::string &name);
+    const smt::Term &tester(const smt::Sort &srt, const std::string &name);
+
+    // Application of a constructor with no arguments
+    const smt::Term &unit(const smt::Sort &srt, const std::string &name);
+
+    const smt::Term &numeral(const int64_t &v, const smt::Sort &srt);
+
+private:
+    // Handles of one sort
+    struct Tables
+    {
+        Vt args;
+        smt::Sort nodes;
+        std::unordered_map<std::string, smt::Term> selectors, constructors, testers, units;
+        std::map<int64_t, smt::Term> numerals;
+    };
+
+    smt::SmtSolver slv;
+    smt::Sort Int;
+    std::unordered_map<smt::Sort, Tables> tables;
+};
+
+/**
+ * @param slv Solver
+ * @return The Int sort
+ */
+smt::Sort intsort(const smt::SmtSolver &slv);
+
+/**
+ * @param slv Solver
+ * @param v Value
+ * @param srt Int or bit-vector sort
+ * @return A numeral of that sort
+ */
+smt::Term numeral(const smt::SmtSolver &slv, const int64_t &v, const smt::Sort &srt);
+
 /**
  * Create instance of some constructor which takes no arguments
  *
@@ -56,10 +140,11 @@ smt::Term unit(const smt::SmtSolver &slv,
 /**
  * Number of AST selectors for the ast constructor
  *
+ * @param slv Solver of the sort
  * @param astSort AST sort from create_datatypes()
  * @return the highest i for which there is a selector a_i::AST
  */
-int arity(const smt::Sort &astSort);
+int arity(const smt::SmtSolver &slv, const smt::Sort &astSort);
 
 /**
  * Apply node selector to an AST term (which has a node and args).
@@ -122,6 +207,46 @@ smt::Term replace(const smt::SmtSolver &slv,
  */
 Vi take(const Vi &vec, const size_t &n);
 
+/**
+ * The subterms of one AST term, as chains of selectors which are built once
+ * per path prefix: a trie of the paths asked for so far, each node holding
+ * the subterm at its path. Encodings which look at many overlapping paths of
+ * the same term (every path of getAt and replaceAt, every subterm a rule
+ * pattern checks or copies) share one instead of rebuilding each chain from
+ * the root.
+ */
+struct Subterms
+{
+public:
+    /**
+     * @param slv Solver
+     * @param root Term of AST sort
+     */
+    Subterms(const smt::SmtSolver &slv, const smt::Term &root);
+
+    const smt::Term &root() const;
+
+    /**
+     * Same as subterm(slv, root, pth), extending the longest prefix of pth
+     * which was already built
+     */
+    smt::Term at(const Vi &pth);
+
+    // Number of paths built (the empty path included)
+    size_t size() const;
+
+private:
+    struct Node
+    {
+        smt::Term term;
+        std::map<int, int> next;
+    };
+    smt::SmtSolver slv;
+    std::vector<Node> nodes;
+    // Selector of each argument (fetched on first use)
+    Vt selectors;
+};
+
 /**
  * Replace an arbitrary subterm, specified by a path
  *
@@ -129,12 +254,14 @@ Vi take(const Vi &vec, const size_t &n);
  * @param x term for which we will replace a subterm (must be AST sort)
  * @param y replacement term (must be AST sort)
  * @param pth Location of subterm
+ * @param xs Subterms of x to reuse (if null, only used for this call)
  * @return SMT-lib AST term representing the substitution result.
  */
 smt::Term replP_fun(const smt::SmtSolver &slv,
                     const smt::Term &x,
                     const smt::Term &y,
-                    const Vi &pth);
+                    const Vi &pth,
+                    Subterms *xs = nullptr);
 /**
  * Apply selectors a1(a3(a4(...(x)))), specified by a vector
  *
@@ -164,6 +291,80 @@ int64_t strhash(const std::string &s);
  */
 std::string strhashinv(const int64_t &i);
 
+// Low bits of a bit-vector node which hold the offset of a free variable
+// (the Int encoding also assumes fewer than 10 free variables per rule)
+const int offset_bits = 4;
+
+/**
+ * Sort of the node selector: Int, or a bit-vector with Encoding::BitVectors
+ *
+ * @param slv Solver
+ * @param astSort AST sort from create_datatypes()
+ */
+smt::Sort nodesort(const smt::SmtSolver &slv, const smt::Sort &astSort);
+
+/**
+ * Sort of the step counter which numbers free variables: Int, or a
+ * bit-vector as wide as the step field of a bit-vector node
+ *
+ * @param slv Solver
+ * @param astSort AST sort from create_datatypes()
+ */
+smt::Sort stepsort(const smt::SmtSolver &slv, const smt::Sort &astSort);
+
+/**
+ * Node value of a symbol: its code in the theory if it has one, otherwise
+ * (e.g. a variable of a query) strhash() of it, or the number of codes plus
+ * its Sym::id() with bit-vectors
+ *
+ * @param slv Solver
+ * @param astSort AST sort from create_datatypes()
+ * @param t Theory whose codes are used
+ * @param s Symbol
+ */
+smt::Term mknode(const smt::SmtSolver &slv,
+                 const smt::Sort &astSort,
+                 const Theory &t,
+                 const Sym &s);
+
+/**
+ * Node value of a free variable introduced by a rewrite: -10*step+offset,
+ * or with bit-vectors the top bit set, then the step, then the offset
+ *
+ * @param slv Solver
+ * @param astSort AST sort from create_datatypes()
+ * @param step Step counter (of stepsort())
+ * @param offset Which of the rule's free variables (from 1)
+ */
+smt::Term mkfresh(const smt::SmtSolver &slv,
+                  const smt::Sort &astSort,
+                  const smt::Term &step,
+                  const int &offset);
+
+/**
+ * Inverse of mknode() and mkfresh() for a bit-vector node value
+ *
+ * @param t Theory whose codes are used
+ * @param value Value of the node
+ * @param width Encoding::node_bits
+ * @returns the symbol (FREE... for a free variable, see freshvar())
+ */
+Sym bvnode_sym(const Theory &t, const uint64_t &value, const int &width);
+
+/**
+ * Whether a term of the Rule sort is some rule direction: a tester of the
+ * Rule datatype, or a comparison with Encoding::BitVectors
+ *
+ * @param slv Solver
+ * @param r Term of the Rule sort
+ * @param rule 1-indexed rule
+ * @param forward Direction
+ */
+smt::Term isrule(const smt::SmtSolver &slv,
+                 const smt::Term &r,
+                 const int &rule,
+                 const bool &forward);
+
 /**
  * Predicate which applies a tester to a term
  *
@@ -217,26 +418,22 @@ smt::Term construct(const smt::SmtSolver &slv,
  *
  * @param solver
  * @param astSort AST datatype from create_datatypes()
+ * @param t Theory whose symbol codes are used for the nodes
  * @param tar term which we will construct with SMT-lib api
- * @param currpth location within the target term we are working on
- * @param src_t
- * @param srchsh
- * @param tarhsh
+ * @param src Subterms of the source term
+ * @param srchsh path of one occurrence of each distinct subterm of the source, by hash
  * @param step
  * @param fv free variables
- * @param syms mapping of symbols to their INT-encoded values
  * @return SMT-lib AST term representing tar.
  */
 smt::Term constructRec(const smt::SmtSolver &slv,
                        const smt::Sort &astSort,
+                       const Theory &t,
                        const Expr &tar,
-                       const Vi &currpth,
-                       const smt::Term &src_t,
-                       const std::map<size_t, Vi> &srchsh,
-                       const std::map<Vi, size_t> &tarhsh,
+                       Subterms &src,
+                       const std::map<Hash128, Vi> &srchsh,
                        const smt::Term &step,
-                       const std::map<std::string, int> fv,
-                       const std::map<std::string, int> &syms);
+                       const std::map<Sym, int> &fv);
 
 /**
  * Helper function for parseCVC
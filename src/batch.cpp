@@ -0,0 +1,95 @@
+#include "batch.hpp"
+#include "instrument.hpp"
+
+Step model_step(const Theory &t,
+                const std::string &rule,
+                const std::string &path,
+                const std::string &state)
+{
+    if (rule.front() == 'R')
+        return {std::stoi(rule.substr(1, rule.size() - 2)),
+                rule.back() == 'f',
+                path_from_name(path),
+                parseCVC(t, state)};
+
+    // Bit-vector rule choice, 2*(rule-1) + (forward ? 0 : 1), printed as
+    // (_ bvN w) or #b...
+    const int rd = rule.front() == '#' ? std::stoi(rule.substr(2), nullptr, 2) : std::stoi(rule.substr(5));
+    return {rd / 2 + 1, rd % 2 == 0, path_from_name(path), parseCVC(t, state)};
+}
+
+Unrolling::Unrolling(const smt::SmtSolver &slv,
+                     const Theory &t,
+                     const int &depth,
+                     const std::string &cache,
+                     const Encoding &enc)
+    : slv(slv), t(t), depth(depth), enc(enc), handles(slv)
+{
+    Instrument::Scope phase("transition");
+    Handles::Use use(handles);
+    std::tie(astSort, pathSort, ruleSort) = create_datatypes(this->slv, t, depth, enc);
+    x = slv->make_symbol("x", astSort);
+    r = slv->make_symbol("r", ruleSort);
+    p = slv->make_symbol("p", pathSort);
+    n = slv->make_symbol("n", stepsort(slv, astSort));
+    trans = cached_rewrite(slv, t, astSort, pathSort, ruleSort, x, r, p, n, depth, enc, cache);
+    states.push_back(slv->make_symbol("x0", astSort));
+}
+
+void Unrolling::extend(const int &steps)
+{
+    Handles::Use use(handles);
+    smt::Sort stepSort = stepsort(slv, astSort);
+    for (int i = states.size() - 1; i < steps; i++)
+    {
+        std::string si = std::to_string(i);
+        rules.push_back(slv->make_symbol("r" + si, ruleSort));
+        paths.push_back(slv->make_symbol("p" + si, pathSort));
+        smt::UnorderedTermMap sub{{x, states.back()},
+                                  {r, rules.back()},
+                                  {p, paths.back()},
+                                  {n, slv->make_term(i, stepSort)}};
+        smt::Term next = slv->substitute(trans, sub);
+        if (enc.symmetry && i > 0)
+        {
+            smt::Term skip = redundant(slv, t, states.back(), next, rules.back(), paths.back(),
+                                       rules.at(i - 1), paths.at(i - 1), depth, enc);
+            next = slv->make_term(smt::Ite, skip, unit(slv, astSort, "Error"), next);
+        }
+        states.push_back(mkConst(slv, "x" + std::to_string(i + 1), next));
+    }
+}
+
+SearchResult Unrolling::check(const Expr &initial, const Expr &final, const int &steps)
+{
+    if (initial == final)
+        return {SearchResult::Found, {}};
+
+    // Permanent assertions: must happen outside of the query's frame
+    Handles::Use use(handles);
+    {
+        Instrument::Scope phase("unroll");
+        extend(steps);
+    }
+    smt::Term c1 = construct(slv, astSort, t, initial);
+    smt::Term c2 = construct(slv, astSort, t, final);
+
+    slv->push();
+    slv->assert_formula(slv->make_term(smt::Equal, states.at(0), c1));
+    SearchResult res{SearchResult::NotFound, {}};
+    for (int k = 1; k <= steps; k++)
+    {
+        Instrument::Scope bound("check_sat " + std::to_string(k));
+        if (!slv->check_sat_assuming({slv->make_term(smt::Equal, states.at(k), c2)}).is_sat())
+            continue;
+        res.status = SearchResult::Found;
+        for (int i = 0; i != k; i++)
+            res.steps.push_back(model_step(t,
+                                           slv->get_value(rules.at(i))->to_string(),
+                                           slv->get_value(paths.at(i))->to_string(),
+                                           slv->get_value(states.at(i + 1))->to_string()));
+        break;
+    }
+    slv->pop();
+    return res;
+}
@@ -0,0 +1,80 @@
+#ifndef BATCH
+#define BATCH
+
+/*
+ * Checking many rewrite queries against one encoding of a theory
+ */
+
+#include <string>
+#include "cache.hpp"
+#include "cvc4extra.hpp"
+#include "rewrite.hpp"
+
+/**
+ * Convert one step of a solver model to a witness step
+ *
+ * @param t Theory the model was built for
+ * @param rule Value of a Rule term, e.g. R2f (or (_ bv2 3) for R2f with bit-vectors)
+ * @param path Value of a Path term, e.g. P12 or (path 2 1 2)
+ * @param state Value of the AST term after the step
+ */
+Step model_step(const Theory &t,
+                const std::string &rule,
+                const std::string &path,
+                const std::string &state);
+
+/**
+ * The rewrite transition relation of a theory, unrolled into a solver once:
+ * x(i+1) = rewrite(x(i), r(i), p(i)) for as many steps as the queries need
+ * (or Error if the step is redundant after the previous one, with
+ * Encoding::symmetry).
+ * The transition is encoded once (or loaded from the cache) and each step
+ * is a substitution into it.
+ *
+ * A query only asserts its initial state inside a push/pop frame and asks for
+ * its final state with check_sat_assuming, so the datatypes and the
+ * (expensive) rewrite terms are shared by every query. The solver must be
+ * created with produce-models and incremental solving enabled.
+ */
+struct Unrolling
+{
+public:
+    /**
+     * @param slv Solver (kept for the lifetime of the unrolling)
+     * @param t Theory (upgraded)
+     * @param depth Max depth at which rewrites are applied, for every query
+     * @param cache Directory of cached encodings (none if empty)
+     * @param enc Encoding of terms and paths (if it is pruned, its analysis
+     *            must start from the initial terms of every query)
+     */
+    Unrolling(const smt::SmtSolver &slv,
+              const Theory &t,
+              const int &depth,
+              const std::string &cache = "build/cache",
+              const Encoding &enc = {});
+
+    /**
+     * Search for a shortest rewrite path with at most `steps` rewrites
+     * @param initial Starting term (upgraded)
+     * @param final Goal term (upgraded)
+     * @param steps Max number of rewrites
+     */
+    SearchResult check(const Expr &initial, const Expr &final, const int &steps);
+
+private:
+    smt::SmtSolver slv;
+    const Theory &t;
+    int depth;
+    Encoding enc;
+    // Used while encoding
+    Handles handles;
+    smt::Sort astSort, pathSort, ruleSort;
+    Vt states, rules, paths;
+    // Transition from x to trans, applying r at p at step n
+    smt::Term x, r, p, n, trans;
+
+    // Make sure there are states for steps 0...steps
+    void extend(const int &steps);
+};
+
+#endif
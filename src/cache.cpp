@@ -0,0 +1,301 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <unordered_map>
+#include "cache.hpp"
+
+/*
+ * The cache file is a header line, a node count, then one line per node of
+ * the term DAG in postorder (the last one being the root):
+ *   L name                    one of the leaves x, r, p, step
+ *   F kind sort names...      a datatype constructor (C), tester (T) or selector (S)
+ *   I value / B value         an Int or Bool constant
+ *   V width value             a bit-vector constant
+ *   O op nidx idx0 idx1 ids.. an operation (by name, since smt-switch may
+ *                             renumber them) applied to earlier nodes
+ */
+
+// Bump whenever the encoding or the file format changes, to invalidate old caches
+static const int cache_version = 3;
+
+namespace
+{
+    // Operators by their smt-switch name
+    const std::map<std::string, smt::PrimOp> &primops()
+    {
+        static const std::map<std::string, smt::PrimOp> ops = [] {
+            std::map<std::string, smt::PrimOp> res;
+            for (int i = 0; i != smt::NUM_OPS_AND_NULL; i++)
+            {
+                smt::PrimOp po = static_cast<smt::PrimOp>(i);
+                res.insert({smt::to_string(po), po});
+            }
+            return res;
+        }();
+        return ops;
+    }
+
+    // Every function of the datatypes, by a name which is stable across runs
+    struct Functions
+    {
+        std::unordered_map<smt::Term, std::string> names;
+        std::map<std::string, smt::Term> terms;
+
+        void add(const std::string &name, const smt::Term &f)
+        {
+            names.insert({f, name});
+            terms.insert({name, f});
+        }
+    };
+
+    // Mirrors the declarations of create_datatypes
+    Functions functions(const smt::SmtSolver &slv,
+                        const Theory &t,
+                        const smt::Sort &astSort,
+                        const smt::Sort &pathSort,
+                        const smt::Sort &ruleSort,
+                        const int &depth,
+                        const Encoding &enc)
+    {
+        Functions fs;
+        auto constructor = [&](const std::string &dt, const smt::Sort &srt, const std::string &c) {
+            fs.add("C " + dt + " " + c, slv->get_constructor(srt, c));
+            fs.add("T " + dt + " " + c, slv->get_tester(srt, c));
+        };
+        const int arity = t.max_arity();
+
+        for (auto &&c : {"Error", "None", "ast"})
+            constructor("AST", astSort, c);
+        fs.add("S AST ast node", slv->get_selector(astSort, "ast", "node"));
+        for (int i = 0; i <= arity; i++)
+        {
+            std::string a = "a" + std::to_string(i);
+            fs.add("S AST ast " + a, slv->get_selector(astSort, "ast", a));
+        }
+
+        if (enc.paths == Encoding::Levels)
+        {
+            constructor("Path", pathSort, "path");
+            fs.add("S Path path len", slv->get_selector(pathSort, "path", "len"));
+            for (int i = 1; i <= depth; i++)
+            {
+                std::string c = "c" + std::to_string(i);
+                fs.add("S Path path " + c, slv->get_selector(pathSort, "path", c));
+            }
+        }
+        else
+        {
+            constructor("Path", pathSort, "Empty");
+            for (auto &&pp : all_paths(depth, arity))
+            {
+                for (auto &&p : pp)
+                    constructor("Path", pathSort, "P" + join(p));
+            }
+        }
+
+        for (int i = 1; enc.nodes == Encoding::Ints && i != std::max(2, static_cast<int>(t.rules.size() + 1)); i++)
+        {
+            for (auto &&d : {"f", "r"})
+                constructor("Rule", ruleSort, "R" + std::to_string(i) + d);
+        }
+        return fs;
+    }
+
+    std::string header(const Theory &t, const int &depth, const Encoding &enc)
+    {
+        return "smt-cache " + std::to_string(cache_version) + " " + t.hash().hex() + " " +
+               std::to_string(depth) + " " + enc.name();
+    }
+
+    // Write the DAG of a term, or return false if it has a node we cannot name
+    bool save(const std::string &path,
+              const std::string &head,
+              const smt::Term &root,
+              const Functions &fs,
+              const std::unordered_map<smt::Term, std::string> &leaves)
+    {
+        std::unordered_map<smt::Term, int> ids;
+        std::vector<std::string> lines;
+        std::vector<std::pair<smt::Term, bool>> stack{{root, false}};
+
+        while (!stack.empty())
+        {
+            auto [x, expanded] = stack.back();
+            stack.pop_back();
+            if (ids.count(x))
+                continue;
+
+            std::string line;
+            smt::SortKind k = x->get_sort()->get_sort_kind();
+            if (fs.names.count(x))
+                line = "F " + fs.names.at(x);
+            else if (leaves.count(x))
+                line = "L " + leaves.at(x);
+            else if (!x->get_op().is_null())
+            {
+                if (!expanded)
+                {
+                    // Children first
+                    stack.push_back({x, true});
+                    for (smt::TermIter it = x->begin(); it != x->end(); ++it)
+                        stack.push_back({*it, false});
+                    continue;
+                }
+                smt::Op op = x->get_op();
+                std::stringstream ss;
+                ss << "O " << smt::to_string(op.prim_op) << " " << op.num_idx << " " << op.idx0 << " " << op.idx1;
+                for (smt::TermIter it = x->begin(); it != x->end(); ++it)
+                    ss << " " << ids.at(*it);
+                line = ss.str();
+            }
+            else if (x->is_value() && k == smt::INT)
+                line = "I " + x->to_string();
+            else if (x->is_value() && k == smt::BOOL)
+                line = "B " + x->to_string();
+            else if (x->is_value() && k == smt::BV)
+                line = "V " + std::to_string(x->get_sort()->get_width()) + " " + std::to_string(x->to_int());
+            else
+                return false;
+
+            ids.insert({x, lines.size()});
+            lines.push_back(line);
+        }
+
+        // Write to a temporary file first so that readers never see half a cache
+        std::string tmp = path + ".tmp" + std::to_string(getpid());
+        bool ok;
+        {
+            std::ofstream out(tmp);
+            out << head << "\n"
+                << lines.size() << "\n";
+            for (auto &&l : lines)
+                out << l << "\n";
+            ok = out.good();
+        }
+        if (ok)
+            std::filesystem::rename(tmp, path);
+        else
+            std::filesystem::remove(tmp);
+        return ok;
+    }
+
+    // Rebuild a saved DAG, or return nullptr if the file is missing or stale
+    smt::Term load(const std::string &path,
+                   const std::string &head,
+                   const smt::SmtSolver &slv,
+                   const Functions &fs,
+                   const std::map<std::string, smt::Term> &leaves)
+    {
+        std::ifstream in(path);
+        std::string line;
+        if (in.fail() || !getline(in, line) || line != head || !getline(in, line))
+            return nullptr;
+        const size_t n = std::stoul(line);
+        smt::Sort Int = slv->make_sort(smt::INT);
+
+        Vt terms;
+        while (terms.size() != n && getline(in, line))
+        {
+            if (line.size() < 3)
+                return nullptr;
+            const std::string rest = line.substr(2);
+            switch (line.front())
+            {
+            case 'F':
+                terms.push_back(fs.terms.at(rest));
+                break;
+            case 'L':
+                terms.push_back(leaves.at(rest));
+                break;
+            case 'I':
+                // Negative values are printed as (- n)
+                terms.push_back(slv->make_term(
+                    rest.front() == '(' ? -std::stoll(rest.substr(3)) : std::stoll(rest), Int));
+                break;
+            case 'B':
+                terms.push_back(slv->make_term(rest == "true"));
+                break;
+            case 'V':
+            {
+                std::stringstream ss(rest);
+                uint64_t width, value;
+                ss >> width >> value;
+                terms.push_back(slv->make_term(value, slv->make_sort(smt::BV, width)));
+                break;
+            }
+            case 'O':
+            {
+                std::stringstream ss(rest);
+                std::string name;
+                uint64_t nidx, idx0, idx1;
+                ss >> name >> nidx >> idx0 >> idx1;
+                // An operator this smt-switch does not know means rebuilding
+                auto po_it = primops().find(name);
+                if (po_it == primops().end())
+                    return nullptr;
+                smt::PrimOp po = po_it->second;
+                smt::Op op = nidx == 0 ? smt::Op(po) : nidx == 1 ? smt::Op(po, idx0) : smt::Op(po, idx0, idx1);
+                smt::TermVec args;
+                for (size_t i; ss >> i;)
+                    args.push_back(terms.at(i));
+                terms.push_back(slv->make_term(op, args));
+                break;
+            }
+            default:
+                return nullptr;
+            }
+        }
+        return terms.size() == n && n ? terms.back() : nullptr;
+    }
+}
+
+std::string cache_path(const Theory &t,
+                       const int &depth,
+                       const Encoding &enc,
+                       const std::string &dir)
+{
+    return dir + "/" + t.hash().hex() + "-" + std::to_string(depth) + "-" + enc.name() + ".smt";
+}
+
+smt::Term cached_rewrite(const smt::SmtSolver &slv,
+                         const Theory &t,
+                         const smt::Sort &astSort,
+                         const smt::Sort &pathSort,
+                         const smt::Sort &ruleSort,
+                         const smt::Term &x,
+                         const smt::Term &r,
+                         const smt::Term &p,
+                         const smt::Term &step,
+                         const int &depth,
+                         const Encoding &enc,
+                         const std::string &dir)
+{
+    if (dir.empty())
+        return rewrite(slv, t, x, r, p, step, depth, enc);
+
+    const std::string path = cache_path(t, depth, enc, dir), head = header(t, depth, enc);
+    Functions fs = functions(slv, t, astSort, pathSort, ruleSort, depth, enc);
+
+    // The cache is only an optimization: any problem with it means rebuilding
+    try
+    {
+        smt::Term res = load(path, head, slv, fs, {{"x", x}, {"r", r}, {"p", p}, {"step", step}});
+        if (res)
+            return res;
+    }
+    catch (const std::exception &)
+    {
+    }
+
+    smt::Term res = rewrite(slv, t, x, r, p, step, depth, enc);
+    try
+    {
+        std::filesystem::create_directories(dir);
+        save(path, head, res, fs, {{x, "x"}, {r, "r"}, {p, "p"}, {step, "step"}});
+    }
+    catch (const std::exception &)
+    {
+    }
+    return res;
+}
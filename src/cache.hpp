@@ -0,0 +1,55 @@
+#ifndef CACHE
+#define CACHE
+
+/*
+ * On-disk cache of the SMT encoding of a theory's rewrite transition
+ */
+
+#include <string>
+#include "astextra.hpp"
+
+/**
+ * Same as rewrite(slv, t, x, r, p, step, depth), but saved to a file in `dir`
+ * keyed by the theory's content hash, the depth and the encoding, and loaded from there
+ * instead of being rebuilt when it is asked for again.
+ *
+ * The cached term is a DAG of solver operations over the datatypes made by
+ * create_datatypes (which must be the sorts given) and the four leaves, so
+ * it can be rebuilt in time linear in its size.
+ *
+ * @param slv Solver
+ * @param t Theory (upgraded)
+ * @param astSort AST sort from create_datatypes()
+ * @param pathSort Path sort from create_datatypes()
+ * @param ruleSort Rule sort from create_datatypes()
+ * @param x Symbol for the incoming term
+ * @param r Symbol for the rule applied
+ * @param p Symbol for the path the rule is applied at
+ * @param step Symbol for the step number
+ * @param depth Max depth at which rewrites are applied
+ * @param enc Encoding the sorts were created with
+ * @param dir Cache directory (empty to disable caching)
+ * @returns the transition term
+ */
+smt::Term cached_rewrite(const smt::SmtSolver &slv,
+                         const Theory &t,
+                         const smt::Sort &astSort,
+                         const smt::Sort &pathSort,
+                         const smt::Sort &ruleSort,
+                         const smt::Term &x,
+                         const smt::Term &r,
+                         const smt::Term &p,
+                         const smt::Term &step,
+                         const int &depth,
+                         const Encoding &enc = {},
+                         const std::string &dir = "build/cache");
+
+/**
+ * @returns Where cached_rewrite keeps the encoding of a theory at some depth
+ */
+std::string cache_path(const Theory &t,
+                       const int &depth,
+                       const Encoding &enc,
+                       const std::string &dir);
+
+#endif
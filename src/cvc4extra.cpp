@@ -1,8 +1,31 @@
 #include <fstream>
 #include <iostream>
+#include <map>
 #include "cvc4extra.hpp"
+#include "instrument.hpp"
 #include "smt-switch/cvc4_factory.h"
 #include "smt-switch/cvc4_solver.h"
+#ifdef WITH_Z3
+#include "smt-switch/z3_factory.h"
+#endif
+
+smt::SmtSolver make_solver(const std::string &backend, const bool &incremental)
+{
+    smt::SmtSolver slv;
+    if (backend == "cvc4")
+        slv = smt::CVC4SolverFactory::create(false);
+#ifdef WITH_Z3
+    else if (backend == "z3")
+        slv = smt::Z3SolverFactory::create(false);
+#endif
+    else
+        throw std::runtime_error("Solver backend " + backend + " is unknown or was not built in");
+
+    slv->set_opt("produce-models", "true");
+    if (incremental)
+        slv->set_opt("incremental", "true");
+    return slv;
+}
 
 smt::Term mkConst(const smt::SmtSolver &slv,
                   const std::string &name,
@@ -15,11 +38,49 @@ smt::Term mkConst(const smt::SmtSolver &slv,
     return v;
 }
 
+// Calls of each function in progress (on this thread)
+static thread_local std::map<std::string, int> calls;
+
+TermCount::TermCount(const std::string &fn) : fn(fn), on(Instrument::enabled()), outer(false), before(0)
+{
+    if (!on)
+        return;
+    outer = calls[fn]++ == 0;
+    before = Instrument::seen();
+}
+
+TermCount::~TermCount()
+{
+    if (!on)
+        return;
+    calls[fn]--;
+    if (outer)
+        Instrument::count(fn, 1, Instrument::seen() - before);
+}
+
+const smt::Term &TermCount::operator()(const smt::Term &res) const
+{
+    if (!on)
+        return res;
+    Vt todo{res};
+    while (!todo.empty())
+    {
+        smt::Term x = todo.back();
+        todo.pop_back();
+        if (!Instrument::see(x->get_id()))
+            continue; // and so are its subterms
+        for (auto &&c : *x)
+            todo.push_back(c);
+    }
+    return res;
+}
+
 smt::Term ITE(const smt::SmtSolver &slv,
               const Vt &ifs,
               const Vt &thens,
               const smt::Term &otherwise)
 {
+    TermCount count("ITE");
     if (ifs.size() != thens.size())
         throw std::runtime_error("Called ITE with unequal ifs/thens");
 
@@ -28,18 +89,23 @@ smt::Term ITE(const smt::SmtSolver &slv,
     {
         ret = slv->make_term(smt::Ite, ifs.at(i), thens.at(i), ret);
     }
-    return ret;
+    return count(ret);
 }
 
-void writeModel(smt::SmtSolver &slv, std::string pth)
+void writeModel(smt::SmtSolver &slv, std::string pth, const Vt &terms)
 {
     smt::Result res = slv->check_sat();
     if (res.is_sat())
     {
-        CVC4::api::Solver &cvc4slv = std::static_pointer_cast<smt::CVC4Solver>(slv)->get_cvc4_solver();
         std::ofstream outfile;
         outfile.open("build/" + pth);
-        cvc4slv.printModel(outfile);
+        if (auto cvc4 = std::dynamic_pointer_cast<smt::CVC4Solver>(slv))
+            cvc4->get_cvc4_solver().printModel(outfile);
+        else
+        {
+            for (auto &&t : terms)
+                outfile << "(define-fun " << t << " () " << t->get_sort()->to_string() << " " << slv->get_value(t) << ")" << std::endl;
+        }
         outfile.close();
     }
 }
@@ -2,9 +2,11 @@
 #define CVC4EXTRA
 
 /*
- * Helper functions related exclusively to CVC4
+ * Helper functions related to the solvers (CVC4 unless another smt-switch
+ * backend is asked for)
  */
 
+#include <string>
 #include <vector>
 #include "smt-switch/smt.h"
 
@@ -12,6 +14,16 @@ typedef std::vector<smt::Term> Vt;
 typedef std::vector<std::pair<std::string, std::string>> ResStep;
 typedef std::vector<ResStep> Res;
 
+/**
+ * Create a solver (with models enabled) of one of the smt-switch backends
+ * with datatypes, which every encoding of terms uses (for the AST): cvc4
+ * always, z3 when built with WITH_Z3 (see the Makefile)
+ * @param backend Name of the backend
+ * @param incremental Whether to enable incremental solving
+ * @returns The solver
+ */
+smt::SmtSolver make_solver(const std::string &backend = "cvc4", const bool &incremental = false);
+
 /**
  * Declare a constant to be equal to a term
  * @param slv Solver - modified to make the assertion
@@ -36,12 +48,40 @@ smt::Term ITE(const smt::SmtSolver &slv,
               const Vt &thens,
               const smt::Term &otherwise);
 
+/**
+ * Counts a call of an SMT encoding function, and the terms it builds, for
+ * Instrument (if it is enabled): construct one on entry to the function and
+ * pass its result through it
+ */
+struct TermCount
+{
+public:
+    TermCount(const std::string &fn);
+    ~TermCount();
+
+    /**
+     * Mark every subterm of a result as seen
+     * @returns The result
+     */
+    const smt::Term &operator()(const smt::Term &res) const;
+
+private:
+    std::string fn;
+    bool on;
+    // Whether this is the outermost call of fn (only that one is counted)
+    bool outer;
+    // Number of terms seen when the call started
+    size_t before;
+};
+
 /**
  * Print model (if it is sat) to a path
  * @param slv Solver
  * @param pth Path to file to print
+ * @param terms What to print the values of, if the backend cannot print a
+ *              whole model itself (only CVC4 can)
  */
-void writeModel(smt::SmtSolver &slv, std::string pth);
+void writeModel(smt::SmtSolver &slv, std::string pth, const Vt &terms = {});
 
 /**
  * Render the results of a transition system result
@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+#include "egraph.hpp"
+#include "ruleindex.hpp"
+
+EGraph::EGraph(const Theory &t) : t(t), skipped(false) {}
+
+size_t EGraph::size() const { return nodes.size(); }
+
+bool EGraph::complete() const { return !skipped; }
+
+int EGraph::find(const int &n)
+{
+    int root = n;
+    while (uf.at(root) != root)
+        root = uf.at(root);
+    for (int i = n; uf.at(i) != root;)
+    {
+        int next = uf.at(i);
+        uf.at(i) = root;
+        i = next;
+    }
+    return root;
+}
+
+EGraph::Key EGraph::key(const int &n)
+{
+    const Node &node = nodes.at(n);
+    Vi cs;
+    for (auto &&c : node.children)
+        cs.push_back(find(c));
+    return {node.term.sym.id(), node.term.kind, cs};
+}
+
+int EGraph::add(const Expr &x)
+{
+    auto it = memo.find(x);
+    if (it != memo.end())
+        return it->second;
+
+    Vi children;
+    for (auto &&a : x.args)
+        children.push_back(add(a));
+
+    int n = nodes.size();
+    nodes.push_back({x, children});
+    uf.push_back(n);
+    proof.push_back({n, 0, true});
+    memo.insert({x, n});
+
+    Key k = key(n);
+    auto h = hashcons.find(k);
+    if (h == hashcons.end())
+    {
+        hashcons.insert({k, n});
+        classes[n].nodes.push_back(n);
+        for (auto &&c : children)
+            classes.at(find(c)).parents.push_back(n);
+    }
+    else
+    {
+        // Congruent to an existing node: the class already has its representative
+        classes[n];
+        merge(n, h->second, 0, true);
+    }
+    return n;
+}
+
+void EGraph::reroot(const int &n)
+{
+    // Reverse the edges on the path from n to the root of its proof tree
+    int prev = n;
+    ProofEdge e = proof.at(n);
+    proof.at(n) = {n, 0, true};
+    while (e.next != prev)
+    {
+        int x = e.next;
+        ProofEdge old = proof.at(x);
+        proof.at(x) = {prev, e.rule, !e.forward};
+        prev = x;
+        e = old;
+    }
+}
+
+bool EGraph::merge(const int &a, const int &b, const int &rule, const bool &forward)
+{
+    int ra = find(a), rb = find(b);
+    if (ra == rb)
+        return false;
+
+    reroot(a);
+    proof.at(a) = {b, rule, forward};
+
+    Class &ca = classes.at(ra), &cb = classes.at(rb);
+    if (ca.nodes.size() + ca.parents.size() < cb.nodes.size() + cb.parents.size())
+    {
+        std::swap(ra, rb);
+    }
+    Class &big = classes.at(ra), &small = classes.at(rb);
+    big.nodes.insert(big.nodes.end(), small.nodes.begin(), small.nodes.end());
+    big.parents.insert(big.parents.end(), small.parents.begin(), small.parents.end());
+    classes.erase(rb);
+    uf.at(rb) = ra;
+    pending.push_back(ra);
+    return true;
+}
+
+void EGraph::rebuild()
+{
+    while (!pending.empty())
+    {
+        Vi todo;
+        std::swap(todo, pending);
+        for (auto &&c : todo)
+        {
+            Vi parents = classes.at(find(c)).parents;
+            for (auto &&p : parents)
+            {
+                Key k = key(p);
+                auto h = hashcons.find(k);
+                if (h == hashcons.end())
+                    hashcons.insert({k, p});
+                else if (find(h->second) != find(p))
+                    merge(p, h->second, 0, true);
+            }
+        }
+    }
+
+    // Nodes (and parents) which have become congruent only need to be kept once
+    for (auto &&[c, data] : classes)
+    {
+        for (Vi *ns : {&data.nodes, &data.parents})
+        {
+            std::set<Key> seen;
+            Vi kept;
+            for (auto &&n : *ns)
+            {
+                if (seen.insert(key(n)).second)
+                    kept.push_back(n);
+            }
+            std::swap(*ns, kept);
+        }
+    }
+}
+
+std::vector<EGraph::Subst> EGraph::match(const Expr &pat, const int &c, const Subst &s)
+{
+    std::vector<Subst> res;
+    const Vi &ns = classes.at(find(c)).nodes;
+
+    if (pat.kind == Expr::VarNode)
+    {
+        auto it = s.find(pat.sym);
+        if (it != s.end())
+        {
+            if (find(it->second) == find(c))
+                res.push_back(s);
+            return res;
+        }
+        // Bind to any node which is a term (carrying its sort): all are equivalent
+        for (auto &&n : ns)
+        {
+            const Node &node = nodes.at(n);
+            if (node.term.kind == Expr::SortNode || node.children.empty() ||
+                node.term.args.at(0).kind != Expr::SortNode)
+                continue;
+            Subst s2 = s;
+            s2.insert({pat.sym, n});
+            return match(pat.args.at(0), node.children.at(0), s2);
+        }
+        return res;
+    }
+
+    for (auto &&n : Vi(ns))
+    {
+        const Node &node = nodes.at(n);
+        if (node.term.sym != pat.sym || node.term.kind != pat.kind ||
+            node.children.size() != pat.args.size())
+            continue;
+        std::vector<Subst> curr{s};
+        for (int i = 0; i != pat.args.size() && !curr.empty(); i++)
+        {
+            std::vector<Subst> next;
+            for (auto &&s2 : curr)
+            {
+                for (auto &&s3 : match(pat.args.at(i), nodes.at(n).children.at(i), s2))
+                    next.push_back(s3);
+            }
+            std::swap(curr, next);
+        }
+        res.insert(res.end(), curr.begin(), curr.end());
+    }
+    return res;
+}
+
+std::optional<int> EGraph::lookup(const Expr &pat, const Subst &s)
+{
+    if (pat.kind == Expr::VarNode)
+        return find(s.at(pat.sym));
+    Vi cs;
+    for (auto &&a : pat.args)
+    {
+        std::optional<int> c = lookup(a, s);
+        if (!c)
+            return std::nullopt;
+        cs.push_back(*c);
+    }
+    auto h = hashcons.find({pat.sym.id(), pat.kind, cs});
+    if (h == hashcons.end())
+        return std::nullopt;
+    return find(h->second);
+}
+
+int EGraph::instantiate(const Expr &pat, const Subst &s)
+{
+    if (pat.kind == Expr::VarNode)
+        return s.at(pat.sym);
+    Ve args;
+    for (auto &&a : pat.args)
+        args.push_back(nodes.at(instantiate(a, s)).term);
+    return add({pat.sym, pat.kind, args});
+}
+
+bool EGraph::apply_rules(const size_t &max_nodes)
+{
+    struct Match
+    {
+        int rule;
+        bool forward;
+        int c;
+        Subst s;
+    };
+
+    size_t before = hashcons.size(), nclasses = classes.size();
+
+    // Search every class before changing the graph
+    Vi roots;
+    for (auto &&[c, _] : classes)
+        roots.push_back(c);
+    std::sort(roots.begin(), roots.end());
+
+    // Rules which may match some node of each class, by top symbol
+    std::map<int, std::set<RuleIndex::Candidate>> candidates;
+    for (auto &&c : roots)
+    {
+        for (auto &&n : classes.at(c).nodes)
+        {
+            const Node &node = nodes.at(n);
+            for (auto &&cand : t.rule_index().candidates(node.term.sym, node.children.size()))
+                candidates[c].insert(cand);
+        }
+    }
+
+    std::vector<Match> matches;
+    for (int r = 1; r <= t.rules.size(); r++)
+    {
+        for (auto &&forward : {true, false})
+        {
+            if (has_freevar(t, r, forward))
+            {
+                skipped = true;
+                continue;
+            }
+            const Rule &rule = t.rules.at(r - 1);
+            const Expr &src = forward ? rule.t1 : rule.t2;
+            // Matches binding variables to the same classes are redundant
+            std::set<std::map<Sym, int>> seen;
+            for (auto &&c : roots)
+            {
+                if (!candidates[c].count({r, forward}))
+                    continue;
+                for (auto &&s : match(src, c, {}))
+                {
+                    std::map<Sym, int> cs;
+                    for (auto &&[v, n] : s)
+                        cs.insert({v, find(n)});
+                    if (seen.insert(cs).second)
+                        matches.push_back({r, forward, c, s});
+                }
+            }
+        }
+    }
+
+    for (auto &&m : matches)
+    {
+        if (max_nodes && nodes.size() >= max_nodes)
+            return true;
+        const Rule &rule = t.rules.at(m.rule - 1);
+        const Expr &src = m.forward ? rule.t1 : rule.t2;
+        const Expr &tar = m.forward ? rule.t2 : rule.t1;
+
+        // Nothing to do if the result is already known to be equal
+        std::optional<int> known = lookup(tar, m.s);
+        if (known && *known == find(m.c))
+            continue;
+
+        // Rewrite a concrete representative, so each rule edge of the proof
+        // forest is exactly one rewrite_top
+        int x = instantiate(src, m.s);
+        std::optional<Expr> y = rewrite_top(t, nodes.at(x).term, m.rule, m.forward, 0);
+        if (!y)
+        {
+            skipped = true; // sorts of the representatives do not line up
+            continue;
+        }
+        merge(x, add(*y), m.rule, m.forward);
+    }
+    rebuild();
+    return hashcons.size() != before || classes.size() != nclasses;
+}
+
+void EGraph::explain_rec(const int &a, const int &b, const Vi &prefix, std::vector<Move> &out)
+{
+    if (a == b)
+        return;
+
+    // Paths from a and b to their nearest common ancestor in the proof tree
+    std::map<int, int> depth_a;
+    Vi up_a{a};
+    for (int x = a; proof.at(x).next != x; x = proof.at(x).next)
+        up_a.push_back(proof.at(x).next);
+    for (int i = 0; i != up_a.size(); i++)
+        depth_a.insert({up_a.at(i), i});
+    Vi up_b{b};
+    while (!depth_a.count(up_b.back()))
+        up_b.push_back(proof.at(up_b.back()).next);
+    int lca = depth_a.at(up_b.back());
+
+    auto edge = [&](const int &x, const int &y, const int &rule, const bool &forward) {
+        if (rule)
+        {
+            out.push_back({rule, forward, prefix});
+            return;
+        }
+        // Congruence: explain the children pairwise
+        for (int i = 0; i != nodes.at(x).children.size(); i++)
+        {
+            Vi p = prefix;
+            p.push_back(i);
+            explain_rec(nodes.at(x).children.at(i), nodes.at(y).children.at(i), p, out);
+        }
+    };
+
+    for (int i = 0; i != lca; i++)
+    {
+        const ProofEdge &e = proof.at(up_a.at(i));
+        edge(up_a.at(i), e.next, e.rule, e.forward);
+    }
+    for (size_t i = up_b.size() - 1; i--;)
+    {
+        const ProofEdge &e = proof.at(up_b.at(i));
+        edge(e.next, up_b.at(i), e.rule, !e.forward);
+    }
+}
+
+Steps EGraph::explain(const int &a, const int &b)
+{
+    if (find(a) != find(b))
+        throw std::runtime_error("Cannot explain nodes in different classes");
+    std::vector<Move> moves;
+    explain_rec(a, b, {}, moves);
+
+    // Replay the moves to get the whole term after each step
+    Steps res;
+    std::vector<Expr> curr{nodes.at(a).term};
+    for (int i = 0; i != moves.size(); i++)
+    {
+        const Move &m = moves.at(i);
+        std::optional<Expr> y = apply_step(t, curr.back(), {m.rule, m.forward, m.path, curr.back()}, i);
+        if (!y)
+            throw std::runtime_error("Invalid explanation at step " + std::to_string(i));
+        res.push_back({m.rule, m.forward, m.path, *y});
+        curr.push_back(*y);
+    }
+    if (curr.back() != nodes.at(b).term)
+        throw std::runtime_error("Explanation does not reach the goal");
+    return res;
+}
+
+SearchResult egraph_search(const Theory &t,
+                           const Expr &initial,
+                           const Expr &final,
+                           const size_t &max_nodes,
+                           const int &max_iters)
+{
+    EGraph g(t);
+    int a = g.add(initial), b = g.add(final);
+    for (int i = 0; i != max_iters && g.find(a) != g.find(b); i++)
+    {
+        if (g.size() >= max_nodes)
+            return {SearchResult::NotFound, {}};
+        if (!g.apply_rules(max_nodes))
+            return {g.complete() ? SearchResult::Refuted : SearchResult::NotFound, {}};
+    }
+    if (g.find(a) != g.find(b))
+        return {SearchResult::NotFound, {}};
+    try
+    {
+        return {SearchResult::Found, g.explain(a, b)};
+    }
+    catch (const std::runtime_error &)
+    {
+        return {SearchResult::Error, {}};
+    }
+}
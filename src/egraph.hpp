@@ -0,0 +1,142 @@
+#ifndef EGRAPH
+#define EGRAPH
+
+/*
+ * Equality saturation: every term equivalent (by the rules of a theory) to
+ * the terms added so far, represented compactly as an e-graph
+ */
+
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include "rewrite.hpp"
+
+/**
+ * E-graph whose e-nodes are concrete (upgraded) terms.
+ *
+ * Every node is a distinct Expr whose children are themselves nodes, so that
+ * a proof forest over nodes (as in Nieuwenhuis & Oliveras' congruence
+ * closure with explanations) can turn an equality back into a sequence of
+ * rule applications at paths. Classes are found with union-find; nodes which
+ * are congruent to an existing one are merged with it on insertion and when
+ * the graph is rebuilt.
+ */
+struct EGraph
+{
+public:
+    explicit EGraph(const Theory &t);
+
+    /**
+     * Add a term and all its subterms
+     * @returns node of the term
+     */
+    int add(const Expr &x);
+
+    /**
+     * @returns Canonical class of a node
+     */
+    int find(const int &n);
+
+    /**
+     * @returns Number of nodes
+     */
+    size_t size() const;
+
+    /**
+     * Apply every rule, in both directions, at every class (one round of
+     * equality saturation), then restore congruence.
+     * Rule directions which introduce free variables are not applied.
+     *
+     * @param max_nodes Stop adding nodes past this many (0 means no limit)
+     * @returns Whether the graph changed (if not, it is saturated)
+     */
+    bool apply_rules(const size_t &max_nodes = 0);
+
+    /**
+     * @returns Whether saturation proves that terms in different classes are
+     * not equivalent (false if some rule or match had to be skipped)
+     */
+    bool complete() const;
+
+    /**
+     * Explain why two nodes are in the same class
+     * @returns Rewrites of the term of a into the term of b
+     */
+    Steps explain(const int &a, const int &b);
+
+private:
+    struct Node
+    {
+        Expr term;
+        Vi children;
+    };
+
+    // Nodes of a class (one per distinct congruence key) and nodes using it as a child
+    struct Class
+    {
+        Vi nodes;
+        Vi parents;
+    };
+
+    // Proof forest edge from a node: its term rewrites to the term of `next`
+    // by a rule (1-indexed, in some direction) or by congruence (rule 0)
+    struct ProofEdge
+    {
+        int next;
+        int rule;
+        bool forward;
+    };
+
+    // A rule application at an explained step, relative to some subterm
+    struct Move
+    {
+        int rule;
+        bool forward;
+        Vi path;
+    };
+
+    typedef std::map<Sym, int> Subst;
+    typedef std::tuple<int, int, Vi> Key;
+
+    const Theory &t;
+    std::vector<Node> nodes;
+    Vi uf;
+    std::vector<ProofEdge> proof;
+    std::unordered_map<int, Class> classes;
+    std::unordered_map<Expr, int> memo;
+    std::map<Key, int> hashcons;
+    Vi pending;
+    bool skipped;
+
+    Key key(const int &n);
+    bool merge(const int &a, const int &b, const int &rule, const bool &forward);
+    void reroot(const int &n);
+    void rebuild();
+    std::vector<Subst> match(const Expr &pat, const int &c, const Subst &s);
+    std::optional<int> lookup(const Expr &pat, const Subst &s);
+    int instantiate(const Expr &pat, const Subst &s);
+    void explain_rec(const int &a, const int &b, const Vi &prefix, std::vector<Move> &out);
+};
+
+/**
+ * Search for a rewrite path by equality saturation.
+ *
+ * Unlike the other engines this is not bounded by a number of steps or a
+ * depth, only by the size of the e-graph and the number of rounds; the
+ * witness is the explanation of the equality, which need not be shortest.
+ *
+ * @param t Theory (upgraded)
+ * @param initial Starting term (upgraded)
+ * @param final Goal term (upgraded)
+ * @param max_nodes Give up once the e-graph has this many nodes
+ * @param max_iters Give up after this many rounds of rule application
+ * @returns Found (with a witness), Refuted (saturated without the terms
+ * becoming equal), or NotFound
+ */
+SearchResult egraph_search(const Theory &t,
+                           const Expr &initial,
+                           const Expr &final,
+                           const size_t &max_nodes = 10000,
+                           const int &max_iters = 30);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef ENCODING
+#define ENCODING
+
+/*
+ * Options for how terms, paths and rules are represented in SMT
+ */
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "reach.hpp"
+
+/**
+ * Encoding options shared by create_datatypes, rewrite and everything
+ * which reads back a model (the defaults give the original encoding)
+ */
+struct Encoding
+{
+public:
+    typedef enum
+    {
+        // One nullary Path constructor per path: (arity+1)^depth of them,
+        // and getAt/replaceAt have one branch per path
+        Enumerated,
+        // A single Path constructor with a length and one child index per
+        // level: getAt/replaceAt descend one level at a time, linear in depth
+        Levels
+    } PathMode;
+
+    PathMode paths = Enumerated;
+
+    typedef enum
+    {
+        // Node symbols are Ints (codes, strhash for other symbols, and
+        // -10*step+offset for free variables) and rules are a datatype
+        Ints,
+        // Node symbols are bit-vectors of node_bits bits (codes, the number
+        // of codes plus Sym::id() for other symbols, and for free variables
+        // a flag bit, the step and the offset), as are the rule choice
+        // (2*(rule-1) + (forward ? 0 : 1), as few bits as the rules need) and
+        // the step counter; solvers can bit-blast these instead of doing
+        // integer reasoning
+        BitVectors
+    } NodeMode;
+
+    NodeMode nodes = Ints;
+
+    // Width of a node symbol with BitVectors
+    int node_bits = 16;
+
+    // Whether to leave out the rules and paths which static analysis of the
+    // query shows can never be used (callers fill in reach accordingly)
+    bool prune = true;
+
+    // Result of that analysis: only rewrites it allows are encoded (all if null)
+    std::shared_ptr<const Reach> reach;
+
+    // Whether searches rule out steps which undo, repeat or merely reorder
+    // others (see redundant() in astextra.hpp); not part of the transition
+    bool symmetry = true;
+
+    /**
+     * @returns Short description, e.g. to distinguish cached encodings
+     */
+    std::string name() const
+    {
+        return std::string(paths == Levels ? "levels" : "enumerated") +
+               (nodes == BitVectors ? "-bv" + std::to_string(node_bits) : "") +
+               (reach ? "-" + reach->key() : "");
+    }
+
+    /**
+     * Inverse of name() (for command line options)
+     */
+    static PathMode parse_paths(const std::string &s)
+    {
+        if (s == "levels")
+            return Levels;
+        if (s == "enumerated")
+            return Enumerated;
+        throw std::runtime_error("Unknown path encoding " + s);
+    }
+
+    /**
+     * Node modes by name (for command line options): int or bv
+     */
+    static NodeMode parse_nodes(const std::string &s)
+    {
+        if (s == "bv")
+            return BitVectors;
+        if (s == "int")
+            return Ints;
+        throw std::runtime_error("Unknown node encoding " + s);
+    }
+};
+
+#endif
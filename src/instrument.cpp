@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <unordered_set>
+#include <unistd.h>
+#include "instrument.hpp"
+
+namespace
+{
+    std::atomic<bool> active{false};
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::vector<Instrument::Span> spanlog;
+    std::map<std::string, Instrument::Counter> counts;
+    std::unordered_set<size_t> ids;
+    // Spans which are open
+    int level = 0;
+    std::mutex lock;
+
+    double micros(const std::chrono::steady_clock::time_point &t)
+    {
+        return std::chrono::duration<double, std::micro>(t - epoch).count();
+    }
+
+    std::string quote(const std::string &s)
+    {
+        std::string res = "\"";
+        for (auto &&c : s)
+        {
+            if (c == '"' || c == '\\')
+                res += '\\';
+            res += c;
+        }
+        return res + "\"";
+    }
+}
+
+Instrument::Scope::Scope(const std::string &name) : name(name), on(enabled())
+{
+    if (!on)
+        return;
+    std::lock_guard<std::mutex> guard(lock);
+    level++;
+    start = std::chrono::steady_clock::now();
+}
+
+Instrument::Scope::~Scope()
+{
+    if (!on)
+        return;
+    auto end = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> guard(lock);
+    level--;
+    spanlog.push_back({name, micros(start), micros(end) - micros(start), level});
+}
+
+bool Instrument::enabled()
+{
+    return active;
+}
+
+void Instrument::enable(const bool &b)
+{
+    active = b;
+}
+
+void Instrument::reset()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    epoch = std::chrono::steady_clock::now();
+    spanlog.clear();
+    counts.clear();
+    ids.clear();
+    level = 0;
+}
+
+void Instrument::count(const std::string &fn, const size_t &calls, const size_t &terms)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    Counter &c = counts[fn];
+    c.calls += calls;
+    c.terms += terms;
+}
+
+bool Instrument::see(const size_t &id)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return ids.insert(id).second;
+}
+
+size_t Instrument::seen()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return ids.size();
+}
+
+std::vector<Instrument::Span> Instrument::spans()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return spanlog;
+}
+
+std::map<std::string, Instrument::Counter> Instrument::counters()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return counts;
+}
+
+std::string Instrument::json()
+{
+    std::vector<Span> sp = spans();
+    std::map<std::string, Counter> cs = counters();
+
+    // Spans are logged as they end, so list them by start
+    std::stable_sort(sp.begin(), sp.end(), [](const Span &a, const Span &b) { return a.start < b.start; });
+    std::map<std::string, double> totals;
+    for (auto &&s : sp)
+        totals[s.name] += s.duration;
+
+    std::stringstream ss;
+    ss << "{\n  \"spans\": [";
+    for (size_t i = 0; i != sp.size(); i++)
+    {
+        ss << (i ? "," : "") << "\n    {\"name\": " << quote(sp.at(i).name)
+           << ", \"start_us\": " << sp.at(i).start
+           << ", \"duration_us\": " << sp.at(i).duration
+           << ", \"level\": " << sp.at(i).level << "}";
+    }
+    ss << "\n  ],\n  \"phases_us\": {";
+    bool first = true;
+    for (auto &&[name, total] : totals)
+    {
+        ss << (first ? "" : ",") << "\n    " << quote(name) << ": " << total;
+        first = false;
+    }
+    ss << "\n  },\n  \"counters\": {";
+    first = true;
+    for (auto &&[fn, c] : cs)
+    {
+        ss << (first ? "" : ",") << "\n    " << quote(fn)
+           << ": {\"calls\": " << c.calls << ", \"terms\": " << c.terms << "}";
+        first = false;
+    }
+    ss << "\n  }\n}\n";
+    return ss.str();
+}
+
+std::string Instrument::trace()
+{
+    std::vector<Span> sp = spans();
+    std::map<std::string, Counter> cs = counters();
+    int pid = getpid();
+
+    std::stringstream ss;
+    ss << "{\"traceEvents\": [";
+    double end = 0;
+    for (size_t i = 0; i != sp.size(); i++)
+    {
+        ss << (i ? "," : "") << "\n  {\"name\": " << quote(sp.at(i).name)
+           << ", \"ph\": \"X\", \"ts\": " << sp.at(i).start
+           << ", \"dur\": " << sp.at(i).duration
+           << ", \"pid\": " << pid << ", \"tid\": 0}";
+        end = std::max(end, sp.at(i).start + sp.at(i).duration);
+    }
+
+    // One counter event at the end holds the totals
+    if (!cs.empty())
+    {
+        ss << (sp.empty() ? "" : ",") << "\n  {\"name\": \"SMT terms\", \"ph\": \"C\", \"ts\": " << end
+           << ", \"pid\": " << pid << ", \"args\": {";
+        bool first = true;
+        for (auto &&[fn, c] : cs)
+        {
+            ss << (first ? "" : ", ") << quote(fn) << ": " << c.terms;
+            first = false;
+        }
+        ss << "}}";
+    }
+    ss << "\n]}\n";
+    return ss.str();
+}
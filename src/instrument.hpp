@@ -0,0 +1,94 @@
+#ifndef INSTRUMENT
+#define INSTRUMENT
+
+/*
+ * Where the time of a query goes: timed phases and counts of the SMT terms
+ * built by each encoding function, collected only while enabled
+ */
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Process-wide profile. Nothing is recorded (and each instrumented call
+ * costs one check) unless enable() was called.
+ */
+struct Instrument
+{
+public:
+    // A timed phase, in microseconds since the profile was reset
+    struct Span
+    {
+        std::string name;
+        double start;
+        double duration;
+        // Number of enclosing spans
+        int level;
+    };
+
+    // What the calls of one encoding function built
+    struct Counter
+    {
+        size_t calls = 0;
+        // SMT terms first seen in a result of the function or of anything it
+        // called (nested calls of the same function are counted once)
+        size_t terms = 0;
+    };
+
+    /**
+     * Time a phase from construction to destruction
+     */
+    struct Scope
+    {
+    public:
+        Scope(const std::string &name);
+        ~Scope();
+
+    private:
+        std::string name;
+        bool on;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    static bool enabled();
+    static void enable(const bool &on = true);
+
+    // Forget everything recorded so far
+    static void reset();
+
+    /**
+     * Add to the counter of a function
+     * @param terms Newly seen terms (see seen)
+     */
+    static void count(const std::string &fn, const size_t &calls, const size_t &terms);
+
+    /**
+     * Mark a term as seen
+     * @param id Unique id of the term
+     * @returns Whether it was not seen before
+     */
+    static bool see(const size_t &id);
+
+    // Number of distinct terms seen so far
+    static size_t seen();
+
+    static std::vector<Span> spans();
+    static std::map<std::string, Counter> counters();
+
+    /**
+     * Everything recorded: the spans, the total time of each phase name and
+     * the counters
+     */
+    static std::string json();
+
+    /**
+     * The spans as complete events of the Chrome trace event format (for
+     * chrome://tracing or Perfetto), followed by the counters
+     */
+    static std::string trace();
+};
+
+#endif
@@ -1,16 +1,22 @@
+#include <memory>
 #include <vector>
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <optional>
 
-#include "core/fts.h"
-#include "engines/bmc.h"
 #include "smt-switch/smt.h"
-#include "smt-switch/cvc4_factory.h"
 #include "cvc4extra.hpp"
 #include "astextra.hpp"
 #include "theory.hpp"
+#include "modelcheck.hpp"
+#include "search.hpp"
+#include "egraph.hpp"
+#include "portfolio.hpp"
+#include "batch.hpp"
+#include "instrument.hpp"
+#include "snapshot.hpp"
 #include "theories/theories.hpp"
 /*
  * Accept user input and check (for a finite set of possible steps)
@@ -20,23 +26,109 @@
 /**
  * Prepare theory from user input.
  * @param t either a theory given as a path or a named pre-existing theory
+ * @param cache Directory of snapshots of theory files (none if empty)
  * @returns upgraded theory to be used for term rewriting
  */
-Theory input_theory(const std::string t)
+Theory input_theory(const std::string t, const std::string &cache)
 {
     std::ifstream infile(t);
+    if (!infile.fail() && !cache.empty())
+    {
+        Instrument::Scope phase("load theory");
+        return load_theory(t, cache);
+    }
+    std::optional<Instrument::Scope> phase(std::in_place, "parse theory");
+    Theory parsed = infile.fail() ? get_theory(t) : Theory::parseTheory(t);
+    phase.emplace("upgrade theory");
+    return parsed.upgrade();
+}
+
+/**
+ * Parse and upgrade a term (timed as such)
+ */
+Expr input_term(const Theory &t, const std::string &s)
+{
+    std::optional<Instrument::Scope> phase(std::in_place, "parse term");
+    Expr x = t.parse_expr(s);
+    phase.emplace("upgrade term");
+    return t.upgrade(x);
+}
+
+/**
+ * Write what was recorded by Instrument
+ * @param profile File for the JSON summary (none if empty)
+ * @param trace File for the Chrome trace (none if empty)
+ */
+void write_profile(const std::string &profile, const std::string &trace)
+{
+    if (!profile.empty())
+        std::ofstream(profile) << Instrument::json();
+    if (!trace.empty())
+        std::ofstream(trace) << Instrument::trace();
+}
+
+/**
+ * Check every query of a batch file against one incrementally reused encoding.
+ *
+ * The file gives a theory and a depth on its first two lines, followed by any
+ * number of queries: an initial term, a final term and a max number of steps,
+ * one per line (blank lines are ignored).
+ * @param path Batch file
+ * @param cache Directory of cached encodings (none if empty)
+ * @param enc Encoding of terms and paths
+ * @param solver smt-switch backend (see make_solver)
+ * @returns exit code
+ */
+int run_batch(const std::string &path,
+              const std::string &cache,
+              const Encoding &enc,
+              const std::string &solver = "cvc4")
+{
+    std::ifstream infile(path);
     if (infile.fail())
     {
-        infile.close();
-        return get_theory(t).upgrade();
+        std::cerr << "Cannot read " << path << std::endl;
+        return 1;
     }
-    else
+    std::vector<std::string> lines;
+    std::string line;
+    while (getline(infile, line))
     {
-        return Theory::parseTheory(t).upgrade();
+        if (line.find_first_not_of(" \t\r") != std::string::npos)
+            lines.push_back(line);
     }
-}
+    if (lines.size() < 2 || (lines.size() - 2) % 3)
+    {
+        std::cerr << "Expected a theory, a depth, then (initial, final, steps) triples" << std::endl;
+        return 1;
+    }
+
+    Theory t = input_theory(lines.at(0), cache);
+    int depth = std::stoi(lines.at(1));
+
+    // The encoding is shared, so it is pruned for every query's initial term
+    Encoding e = enc;
+    if (e.prune && !e.reach)
+    {
+        Ve initial;
+        for (size_t i = 2; i != lines.size(); i += 3)
+            initial.push_back(input_term(t, lines.at(i)));
+        e.reach = std::make_shared<Reach>(t, depth, initial);
+    }
+
+    smt::SmtSolver slv = make_solver(solver, true);
+    Unrolling unrolling(slv, t, depth, cache, e);
 
-std::string sep = "\n*******************************************\n";
+    for (size_t i = 2; i != lines.size(); i += 3)
+    {
+        Expr initial_term = input_term(t, lines.at(i));
+        Expr final_term = input_term(t, lines.at(i + 1));
+        int steps = std::stoi(lines.at(i + 2));
+        std::cout << "\nQuery " << (i - 2) / 3 << ": " << lines.at(i) << " to " << lines.at(i + 1) << std::endl;
+        std::cout << print_result(t, initial_term, unrolling.check(initial_term, final_term, steps));
+    }
+    return 0;
+}
 
 int main(int argc, char **argv)
 {
@@ -44,19 +136,70 @@ int main(int argc, char **argv)
     std::string theoryname, term1, term2, depthstr, stepsstr;
     int depth, steps;
 
+    // Command line options
+    std::string engine = "bmc";
+    std::string batch, cache = "build/cache", solver = "cvc4", profile, trace;
+    int threads = 0, timeout = 0;
+    Encoding enc;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--engine" && i + 1 < argc)
+            engine = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = std::stoi(argv[++i]);
+        else if (arg == "--timeout" && i + 1 < argc)
+            timeout = std::stoi(argv[++i]);
+        else if (arg == "--batch" && i + 1 < argc)
+            batch = argv[++i];
+        else if (arg == "--cache" && i + 1 < argc)
+            cache = argv[++i];
+        else if (arg == "--no-cache")
+            cache.clear();
+        else if (arg == "--paths" && i + 1 < argc)
+            enc.paths = Encoding::parse_paths(argv[++i]);
+        else if (arg == "--no-prune")
+            enc.prune = false;
+        else if (arg == "--no-symmetry")
+            enc.symmetry = false;
+        else if (arg == "--solver" && i + 1 < argc)
+            solver = argv[++i];
+        else if (arg == "--nodes" && i + 1 < argc)
+            enc.nodes = Encoding::parse_nodes(argv[++i]);
+        else if (arg == "--node-bits" && i + 1 < argc)
+            enc.node_bits = std::stoi(argv[++i]);
+        else if (arg == "--profile" && i + 1 < argc)
+            profile = argv[++i];
+        else if (arg == "--trace" && i + 1 < argc)
+            trace = argv[++i];
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--engine bmc|kind|ic3|interp|native|egraph|portfolio] [--threads N] [--timeout SECONDS] [--batch FILE] [--cache DIR | --no-cache] [--paths enumerated|levels] [--no-prune] [--no-symmetry] [--nodes int|bv] [--node-bits N] [--solver cvc4|z3] [--profile FILE] [--trace FILE]" << std::endl;
+            return 1;
+        }
+    }
+    if (!profile.empty() || !trace.empty())
+        Instrument::enable();
+    if (!batch.empty())
+    {
+        int code = run_batch(batch, cache, enc, solver);
+        write_profile(profile, trace);
+        return code;
+    }
+
     // Get user input
     std::cout << "Give the name of Generalized Algebraic Theory (or path to file): ";
     getline(std::cin, theoryname);
-    Theory t = input_theory(theoryname);
+    Theory t = input_theory(theoryname, cache);
 
     std::cout << "Give an initial term in this theory: ";
     getline(std::cin, term1);
-    Expr initial_term = t.upgrade(t.parse_expr(term1));
+    Expr initial_term = input_term(t, term1);
 
     std::cout << "Give a final term in this theory: ";
     getline(std::cin, term2);
     assert(term1 != term2);
-    Expr final_term = t.upgrade(t.parse_expr(term2));
+    Expr final_term = input_term(t, term2);
 
     std::cout << "Give max number rewrite steps: ";
     getline(std::cin, stepsstr);
@@ -66,90 +209,61 @@ int main(int argc, char **argv)
     getline(std::cin, depthstr);
     depth = std::stoi(depthstr);
 
-    // Initialize a SMT-switch solver
-    smt::SmtSolver slv = smt::CVC4SolverFactory::create(false);
-    slv->set_opt("produce-models", "true");
-
     std::cout << "\n\nComputing...\n"
               << std::endl;
 
-    // Declare datatypes
-    smt::Sort astSort, pathSort, ruleSort;
-    std::tie(astSort, pathSort, ruleSort) = create_datatypes(slv, t, depth);
-
-    // Declare initial and final terms to the solver as constants
-    smt::Term c1 = construct(slv, astSort, t, initial_term);
-    smt::Term c2 = construct(slv, astSort, t, final_term);
-    smt::Term x1 = mkConst(slv, "initial", c1);
-    smt::Term x2 = mkConst(slv, "final", c2);
-
-    // Create transition system
-    pono::FunctionalTransitionSystem fts(slv);
-    smt::Term state = fts.make_statevar("x", astSort);
-    smt::Sort Int = slv->make_sort(smt::INT);
-    smt::Term zero = slv->make_term(0, Int);
-    smt::Term one = slv->make_term(1, Int);
-
-    //Need counter to allow generating fresh free vars each iteration
-    smt::Term cnt = fts.make_statevar("cnt", Int);
-
-    // Initial state
-    fts.constrain_init(slv->make_term(smt::Equal, state, c1));
-    fts.constrain_init(slv->make_term(smt::Equal, cnt, zero));
-
-    // Variable inputs for each transition
-    smt::Term r = fts.make_inputvar("r", ruleSort);
-    smt::Term p = fts.make_inputvar("p", pathSort);
-
-    // Transition rule
-    fts.assign_next(cnt, slv->make_term(smt::Plus, cnt, one));
-    fts.assign_next(state, rewrite(slv, t, state, r, p, cnt, depth));
-
-    // End goal to demonstrate
-    smt::Term prop = slv->make_term(
-        smt::Not, slv->make_term(smt::Equal, state, c2));
-
-    // Final setup
-    pono::Property property(slv, prop);
-    pono::Bmc bmc(property, fts, slv);
-    std::vector<smt::UnorderedTermMap> wit;
-
-    // Do the model checking
-    switch (bmc.check_until(steps))
+    SearchResult res;
+    std::optional<Instrument::Scope> phase(std::in_place, "search");
+    if (engine == "native")
+        res = native_search(t, initial_term, final_term, steps, depth, threads);
+    else if (engine == "egraph")
+        res = egraph_search(t, initial_term, final_term);
+    else if (engine == "portfolio")
     {
-    case pono::FALSE:
-        bmc.witness(wit);
-        std::cout << "\n"
-                  << wit.size() - 1 << "-step solution found" << std::endl;
-        std::cout << "\n\nStarting from " << term1 << std::endl;
-        for (int i = 0; i + 1 != wit.size(); i++)
+        // BMC at every depth up to the given one (a shallower encoding is
+        // much cheaper, and often deep enough), plus the native engines
+        std::vector<Job> jobs;
+        for (int d = 1; d <= depth; d++)
         {
-            std::string rval = wit.at(i).at(r)->to_string();
-            Rule rule = t.rules.at(std::stoi(rval.substr(1, rval.size() - 2)) - 1);
-            Expr parsed = parseCVC(t, wit.at(i + 1).at(state)->to_string());
-            int forward = (int)(rval.back() == 'f');
-            std::cout << sep << "Step " << i << ": apply " << rval << " ("
-                      << (forward ? "forward" : "reverse")
-                      << ")\n"
-                      << t.print(rule, forward) << "\nat subpath "
-                      << wit.at(i).at(p) << " to yield:\n\t"
-                      << t.print(parsed.uninfer()) << std::endl;
+            jobs.push_back({"bmc depth " + std::to_string(d), [&, d] {
+                                SearchResult r = mc_search(t, initial_term, final_term, steps, d, "", cache, enc, "bmc", solver);
+                                if (d != depth && r.status == SearchResult::Refuted)
+                                    r.status = SearchResult::NotFound; // only refuted for shallow rewrites
+                                return r;
+                            }});
         }
-        break;
-
-    case pono::TRUE:
-        std::cout << "\nNo rewrite possible" << std::endl;
-        break;
-
-    case pono::ERROR:
-        std::cout << "\nError" << std::endl;
-        break;
+        if (enc.paths == Encoding::Enumerated)
+        {
+            // The per-level path encoding stays small at depths where the
+            // enumerated one is slow to even build
+            jobs.push_back({"bmc levels depth " + std::to_string(depth), [&] {
+                                Encoding levels = enc;
+                                levels.paths = Encoding::Levels;
+                                return mc_search(t, initial_term, final_term, steps, depth, "", cache, levels, "bmc", solver);
+                            }});
+        }
+        jobs.push_back({"k-induction depth " + std::to_string(depth), [&] {
+                            return mc_search(t, initial_term, final_term, steps, depth, "", cache, enc, "kind", solver);
+                        }});
+        jobs.push_back({"native", [&] { return native_search(t, initial_term, final_term, steps, depth, threads); }});
+        jobs.push_back({"egraph", [&] { return within_bounds(egraph_search(t, initial_term, final_term), steps, depth); }});
 
-    case pono::UNKNOWN:
-        std::cout << "\nNo solution found" << std::endl;
-        break;
+        std::string winner;
+        res = portfolio(t, initial_term, jobs, timeout, winner);
+        if (!winner.empty())
+            std::cout << "Answered by " << winner << std::endl;
     }
+    else if (engine == "bmc" || engine == "kind" || engine == "ic3" || engine == "interp")
+        res = mc_search(t, initial_term, final_term, steps, depth, "model.dat", cache, enc, engine, solver);
+    else
+    {
+        std::cerr << "Unknown engine " << engine << std::endl;
+        return 1;
+    }
+
+    phase.reset();
 
-    writeModel(slv, "model.dat");
+    std::cout << print_result(t, initial_term, res);
+    write_profile(profile, trace);
     return 0;
 }
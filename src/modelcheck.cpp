@@ -0,0 +1,198 @@
+#include <chrono>
+#include <optional>
+#include "engines/bmc.h"
+#include "engines/kinduction.h"
+#include "engines/mbic3.h"
+#ifdef WITH_MSAT
+#include "engines/interpolantmc.h"
+#include "smt-switch/msat_factory.h"
+#endif
+#include "cache.hpp"
+#include "cvc4extra.hpp"
+#include "batch.hpp"
+#include "instrument.hpp"
+#include "modelcheck.hpp"
+
+// Seconds since a time point
+static double seconds(const std::chrono::steady_clock::time_point &since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+std::unique_ptr<pono::Prover> make_prover(const std::string &name,
+                                          const pono::Property &property,
+                                          const pono::TransitionSystem &ts,
+                                          const smt::SmtSolver &slv)
+{
+    if (name == "bmc")
+        return std::make_unique<pono::Bmc>(property, ts, slv);
+    if (name == "kind")
+        return std::make_unique<pono::KInduction>(property, ts, slv);
+    if (name == "ic3")
+        return std::make_unique<pono::ModelBasedIC3>(property, ts, slv);
+#ifdef WITH_MSAT
+    if (name == "interp")
+        return std::make_unique<pono::InterpolantMC>(property, ts, slv,
+                                                     smt::MsatSolverFactory::create_interpolating_solver());
+#else
+    if (name == "interp")
+        throw std::runtime_error("Interpolation needs MathSAT (build with WITH_MSAT=1)");
+#endif
+    throw std::runtime_error("Unknown model checking engine " + name);
+}
+
+SearchResult mc_search(const Theory &t,
+                       const Expr &initial_term,
+                       const Expr &final_term,
+                       const int &steps,
+                       const int &depth,
+                       const std::string &model,
+                       const std::string &cache,
+                       const Encoding &enc,
+                       const std::string &engine,
+                       const std::string &solver,
+                       McStats *stats)
+{
+    // Initialize a SMT-switch solver
+    auto start = std::chrono::steady_clock::now();
+    std::optional<Instrument::Scope> phase(std::in_place, "solver");
+    smt::SmtSolver slv = make_solver(solver);
+    Handles handles(slv);
+    Handles::Use use(handles);
+
+    // Only encode the rewrites which may happen starting from the initial term
+    Encoding e = enc;
+    phase.emplace("reach");
+    if (e.prune && !e.reach)
+        e.reach = std::make_shared<Reach>(t, depth, Ve{initial_term});
+
+    // Declare datatypes
+    phase.emplace("datatypes");
+    smt::Sort astSort, pathSort, ruleSort;
+    std::tie(astSort, pathSort, ruleSort) = create_datatypes(slv, t, depth, e);
+
+    // Declare initial and final terms to the solver as constants
+    phase.emplace("transition");
+    smt::Term c1 = construct(slv, astSort, t, initial_term);
+    smt::Term c2 = construct(slv, astSort, t, final_term);
+    smt::Term x1 = mkConst(slv, "initial", c1);
+    smt::Term x2 = mkConst(slv, "final", c2);
+
+    // Create transition system
+    pono::FunctionalTransitionSystem fts(slv);
+    smt::Term state = fts.make_statevar("x", astSort);
+    smt::Sort stepSort = stepsort(slv, astSort);
+    smt::Term zero = slv->make_term(0, stepSort);
+    smt::Term one = slv->make_term(1, stepSort);
+
+    // Need counter to allow generating fresh free vars each iteration. It is
+    // unbounded, so k-induction could never close a simple path with it:
+    // when no rule introduces variables it is an (unused) input instead.
+    bool fresh = false;
+    for (int i = 1; i <= t.rules.size(); i++)
+        fresh = fresh || has_freevar(t, i, true) || has_freevar(t, i, false);
+    smt::Term cnt = fresh ? fts.make_statevar("cnt", stepSort) : fts.make_inputvar("cnt", stepSort);
+
+    // Initial state
+    fts.constrain_init(slv->make_term(smt::Equal, state, c1));
+    if (fresh)
+        fts.constrain_init(slv->make_term(smt::Equal, cnt, zero));
+
+    // Variable inputs for each transition
+    smt::Term r = fts.make_inputvar("r", ruleSort);
+    smt::Term p = fts.make_inputvar("p", pathSort);
+
+    // Transition rule
+    if (fresh)
+        fts.assign_next(cnt, slv->make_term(e.nodes == Encoding::BitVectors ? smt::BVAdd : smt::Plus, cnt, one));
+    smt::Term next = cached_rewrite(slv, t, astSort, pathSort, ruleSort, state, r, p, cnt, depth, e, cache);
+
+    // Redundant steps (after the first one) lead to Error, which is never left
+    if (e.symmetry)
+    {
+        smt::Term prevR = fts.make_statevar("prev_r", ruleSort);
+        smt::Term prevP = fts.make_statevar("prev_p", pathSort);
+        fts.assign_next(prevR, r);
+        fts.assign_next(prevP, p);
+        // Whether a step was taken (not cnt != 0, which may be an input)
+        smt::Term started = fts.make_statevar("started", slv->make_sort(smt::BOOL));
+        fts.constrain_init(slv->make_term(smt::Not, started));
+        fts.assign_next(started, slv->make_term(true));
+        smt::Term skip = slv->make_term(smt::And,
+                                        started,
+                                        redundant(slv, t, state, next, r, p, prevR, prevP, depth, e));
+        next = slv->make_term(smt::Ite, skip, unit(slv, astSort, "Error"), next);
+    }
+    fts.assign_next(state, next);
+
+    // End goal to demonstrate
+    smt::Term prop = slv->make_term(
+        smt::Not, slv->make_term(smt::Equal, state, c2));
+
+    // Final setup
+    phase.emplace("prover");
+    pono::Property property(slv, prop);
+    std::unique_ptr<pono::Prover> prover = make_prover(engine, property, fts, slv);
+    prover->initialize();
+    std::vector<smt::UnorderedTermMap> wit;
+    SearchResult res{SearchResult::Error, {}};
+    phase.reset();
+    if (stats)
+        stats->encode = seconds(start);
+
+    // Do the model checking (one bound at a time, if they are timed)
+    pono::ProverResult status = pono::UNKNOWN;
+    bool timed = stats || Instrument::enabled();
+    if (!timed)
+        status = prover->check_until(steps);
+    for (int k = 0; timed && k <= steps && status == pono::UNKNOWN; k++)
+    {
+        Instrument::Scope bound("check_until " + std::to_string(k));
+        start = std::chrono::steady_clock::now();
+        status = prover->check_until(k);
+        if (stats)
+            stats->bounds.push_back(seconds(start));
+    }
+    phase.emplace("witness");
+    switch (status)
+    {
+    case pono::FALSE:
+        prover->witness(wit);
+        res.status = SearchResult::Found;
+        for (int i = 0; i + 1 != wit.size(); i++)
+        {
+            res.steps.push_back(model_step(t,
+                                           wit.at(i).at(r)->to_string(),
+                                           wit.at(i).at(p)->to_string(),
+                                           wit.at(i + 1).at(state)->to_string()));
+        }
+        break;
+
+    case pono::TRUE:
+        res.status = SearchResult::Refuted;
+        if (engine != "bmc")
+        {
+            // Not every engine can produce one
+            try
+            {
+                res.invariant = prover->invar()->to_string();
+            }
+            catch (const std::exception &)
+            {
+            }
+        }
+        break;
+
+    case pono::ERROR:
+        res.status = SearchResult::Error;
+        break;
+
+    case pono::UNKNOWN:
+        res.status = SearchResult::NotFound;
+        break;
+    }
+
+    if (!model.empty())
+        writeModel(slv, model, {x1, x2, state});
+    return res;
+}
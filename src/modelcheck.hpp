@@ -0,0 +1,66 @@
+#ifndef MODELCHECK
+#define MODELCHECK
+
+/*
+ * Searching for rewrite paths with the model checking engines of Pono
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "core/fts.h"
+#include "engines/prover.h"
+#include "encoding.hpp"
+#include "rewrite.hpp"
+
+/**
+ * Where the time of a model checking search went
+ */
+struct McStats
+{
+public:
+    // Seconds to set up the solver, analyse which rewrites may happen (see
+    // Encoding::prune) and build the transition system
+    double encode = 0;
+    // Seconds spent checking each bound, from 0 up to the last one checked
+    std::vector<double> bounds;
+};
+
+/**
+ * Pono engine checking a property of a transition system
+ * @param name bmc (bounded), or kind, ic3, interp (which can also prove the
+ *             property for any number of steps)
+ */
+std::unique_ptr<pono::Prover> make_prover(const std::string &name,
+                                          const pono::Property &property,
+                                          const pono::TransitionSystem &ts,
+                                          const smt::SmtSolver &slv);
+
+/**
+ * Search for a rewrite path by model checking a transition system whose
+ * state is the current term.
+ * @param model File to write the model to (none if empty)
+ * @param cache Directory of cached encodings (none if empty)
+ * @param enc Encoding of terms and paths
+ * @param engine Pono engine (see make_prover): with bmc, Refuted only means
+ *               that no sequence of any length exists if the bound was
+ *               enough to show it, while the others prove it outright
+ * @param solver smt-switch backend (see make_solver)
+ * @param stats If given (or if Instrument is enabled), the bounds are
+ *              checked one at a time and timed
+ * @returns witness (if found), or the inductive invariant (if refuted and
+ *          the engine provides one)
+ */
+SearchResult mc_search(const Theory &t,
+                       const Expr &initial_term,
+                       const Expr &final_term,
+                       const int &steps,
+                       const int &depth,
+                       const std::string &model = "model.dat",
+                       const std::string &cache = "build/cache",
+                       const Encoding &enc = {},
+                       const std::string &engine = "bmc",
+                       const std::string &solver = "cvc4",
+                       McStats *stats = nullptr);
+
+#endif
@@ -0,0 +1,71 @@
+#include <algorithm>
+#include "pattern.hpp"
+
+namespace
+{
+    // Postorder plan building e, copying whatever the input already has
+    void build(const Expr &e,
+               const Theory &t,
+               const std::map<Hash128, Vi> &first,
+               const std::map<Sym, Vi> &vars,
+               const std::map<Sym, int> &fv,
+               std::vector<Pattern::Build> &res)
+    {
+        auto it = first.find(e.hash());
+        if (it != first.end())
+        {
+            res.push_back({Pattern::Build::Copy, it->second, e.sym, e.kind, 0, 0});
+            return;
+        }
+        if (e.kind == Expr::VarNode && vars.count(e.sym))
+        {
+            // Bound, but annotated with a sort written differently
+            res.push_back({Pattern::Build::Copy, vars.at(e.sym), e.sym, e.kind, 0, 0});
+            return;
+        }
+        for (auto &&a : e.args)
+            build(a, t, first, vars, fv, res);
+        if (e.kind == Expr::VarNode)
+            res.push_back({Pattern::Build::Fresh, {}, e.sym, e.kind, fv.at(e.sym), 1});
+        else
+            res.push_back({Pattern::Build::Node, {}, e.sym, e.kind, t.code(e.sym), static_cast<int>(e.args.size())});
+    }
+}
+
+Pattern Pattern::compile(const Theory &t, const int &rule, const bool &forward)
+{
+    const Rule &r = t.rules.at(rule - 1);
+    const Expr &src = forward ? r.t1 : r.t2;
+    const Expr &tar = forward ? r.t2 : r.t1;
+    Pattern res{rule, forward, {}, {}, {}, {}, false};
+
+    std::map<Hash128, Vi> first;
+    std::map<Sym, Vi> vars;
+    std::map<Sym, int> bound;
+    for (auto &&[k, v] : Expr::distinct(src.positions()))
+    {
+        const Vi &rep = v.front();
+        first.insert({k, rep});
+        Expr x = src.subexpr(rep);
+        if (x.kind == Expr::VarNode)
+        {
+            auto it = bound.find(x.sym);
+            res.binds.push_back({x.sym, rep, it == bound.end() ? -1 : it->second});
+            bound.insert({x.sym, res.binds.size() - 1});
+            vars.insert({x.sym, rep});
+        }
+        else
+            res.checks.push_back({rep, x.sym, t.code(x.sym), static_cast<int>(x.args.size())});
+        for (size_t i = 1; i < v.size(); i++)
+            res.same.push_back({v.at(i), rep});
+    }
+    // Preorder, so that a native matcher fails on the shallowest mismatch
+    // and only looks below subterms whose arity has been checked
+    std::sort(res.checks.begin(), res.checks.end(),
+              [](const Check &a, const Check &b) { return a.path < b.path; });
+
+    std::map<Sym, int> fv = tar.freevar(src);
+    res.fresh = !fv.empty();
+    build(tar, t, first, vars, fv, res.plan);
+    return res;
+}
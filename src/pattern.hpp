@@ -0,0 +1,96 @@
+#ifndef PATTERN
+#define PATTERN
+
+/*
+ * Rule patterns compiled into flat programs, once per theory, so that the
+ * SMT encoder and the native matcher share a single (cheap) description of
+ * what each rule direction checks and builds
+ */
+
+#include "theory.hpp"
+
+/**
+ * One direction of a rule, as a program over the subterms of its input:
+ * checks which the input must pass for the rule to apply, then a postorder
+ * plan building the output from pieces of the input.
+ *
+ * Subterms are addressed by paths from the root of the input. Each distinct
+ * subterm of the input pattern is checked once, at its first (preorder)
+ * occurrence; later occurrences only have to be equal to it.
+ *
+ * A variable may occur with sorts written differently (e.g. f:Hom(A,B) and
+ * f:Hom(B,A)). Its occurrences must still bind the same thing, and the output
+ * copies that thing wherever the variable occurs, whatever its sort spelling.
+ */
+struct Pattern
+{
+public:
+    // A non-variable subterm of the pattern: the input must have the same
+    // symbol there, with exactly as many arguments
+    struct Check
+    {
+        Vi path;
+        Sym sym;
+        // Theory::code of the symbol
+        int code;
+        int nargs;
+    };
+
+    // A repeated subterm of the pattern (e.g. a nonlinear variable): the
+    // input must have the same thing at both paths
+    struct Same
+    {
+        Vi path;
+        // First occurrence
+        Vi rep;
+    };
+
+    // First occurrence of a variable of the pattern
+    struct Bind
+    {
+        Sym var;
+        Vi path;
+        // Index of an earlier Bind of the same variable (with a different
+        // sort annotation) which must bind the same thing, or -1
+        int prev;
+    };
+
+    // Instruction of the output plan, run on a stack of terms
+    struct Build
+    {
+        typedef enum
+        {
+            Copy,  // push the input's subterm at path
+            Node,  // pop nargs terms, push them as the args of sym
+            Fresh, // pop a sort, push free variable number `code` of that sort
+        } Op;
+        Op op;
+        Vi path;
+        Sym sym;
+        Expr::NodeType kind;
+        // Theory::code of sym for a Node (0 if the theory does not mention
+        // it), or the variable's number (from Expr::freevar) for a Fresh
+        int code;
+        int nargs;
+    };
+
+    // 1-indexed rule
+    int rule;
+    bool forward;
+    std::vector<Check> checks;
+    std::vector<Same> same;
+    std::vector<Bind> binds;
+    std::vector<Build> plan;
+    // Whether the plan introduces free variables
+    bool fresh;
+
+    /**
+     * Compile one direction of a rule
+     * @param t Theory (upgraded, for the pattern to include sort annotations)
+     * @param rule 1-indexed rule
+     * @param forward Whether t1 is rewritten to t2 or t2 to t1
+     */
+    static Pattern compile(const Theory &t, const int &rule, const bool &forward);
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <sstream>
+#include <stdexcept>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "portfolio.hpp"
+
+// Serialize the parts of a result which do not depend on the process: the
+// status, the steps, then the invariant prefixed by its length
+static std::string encode(const SearchResult &res)
+{
+    std::stringstream ss;
+    ss << res.status << " " << res.steps.size() << "\n";
+    for (auto &&s : res.steps)
+        ss << s.rule << " " << s.forward << " " << path_name(s.path) << "\n";
+    ss << res.invariant.size() << "\n"
+       << res.invariant;
+    return ss.str();
+}
+
+// Inverse of encode, recomputing each intermediate term from the initial one
+static SearchResult decode(const Theory &t, const Expr &initial, const std::string &msg)
+{
+    std::stringstream ss(msg);
+    int status, n;
+    if (!(ss >> status >> n))
+        return {SearchResult::Error, {}};
+
+    SearchResult res{(SearchResult::Status)status, {}};
+    std::vector<Expr> curr{initial};
+    for (int i = 0; i != n; i++)
+    {
+        int rule;
+        bool forward;
+        std::string path;
+        if (!(ss >> rule >> forward >> path))
+            return {SearchResult::Error, {}};
+        Step s{rule, forward, path_from_name(path), curr.back()};
+        std::optional<Expr> y = apply_step(t, curr.back(), s, i);
+        if (!y)
+            return {SearchResult::Error, {}};
+        res.steps.push_back({rule, forward, s.path, *y});
+        curr.push_back(*y);
+    }
+
+    size_t len;
+    if (!(ss >> len) || ss.get() != '\n')
+        return {SearchResult::Error, {}};
+    res.invariant.resize(len);
+    if (!ss.read(&res.invariant[0], len))
+        return {SearchResult::Error, {}};
+    return res;
+}
+
+// Run a job, sending its encoded result down a pipe. Never returns.
+[[noreturn]] static void child(const Job &job, const int &fd)
+{
+    std::string msg;
+    try
+    {
+        msg = encode(job.run());
+    }
+    catch (const std::exception &)
+    {
+        msg = encode({SearchResult::Error, {}});
+    }
+    for (size_t done = 0; done < msg.size();)
+    {
+        ssize_t k = write(fd, msg.data() + done, msg.size() - done);
+        if (k <= 0)
+            break;
+        done += k;
+    }
+    close(fd);
+    _exit(0);
+}
+
+SearchResult portfolio(const Theory &t,
+                       const Expr &initial,
+                       const std::vector<Job> &jobs,
+                       const int &timeout,
+                       std::string &winner)
+{
+    std::vector<pid_t> pids;
+    std::vector<pollfd> fds;
+    std::vector<std::string> msgs(jobs.size());
+
+    // Kill whatever is still running (every job whose output is still open)
+    auto cancel = [&]() {
+        for (size_t i = 0; i != pids.size(); i++)
+        {
+            if (fds[i].fd >= 0)
+            {
+                kill(pids[i], SIGKILL);
+                close(fds[i].fd);
+            }
+            waitpid(pids[i], nullptr, 0);
+        }
+    };
+
+    for (auto &&job : jobs)
+    {
+        int p[2];
+        if (pipe(p))
+        {
+            cancel();
+            throw std::runtime_error("Cannot create pipe");
+        }
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            close(p[0]);
+            close(p[1]);
+            cancel();
+            throw std::runtime_error("Cannot fork");
+        }
+        if (pid == 0)
+        {
+            close(p[0]);
+            child(job, p[1]);
+        }
+        close(p[1]);
+        pids.push_back(pid);
+        fds.push_back({p[0], POLLIN, 0});
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::optional<SearchResult> answer;
+    SearchResult::Status status = SearchResult::Error;
+    size_t open = jobs.size();
+    winner.clear();
+
+    // Collect results as jobs finish, until one is definitive
+    while (open)
+    {
+        int wait = -1;
+        if (timeout > 0)
+        {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+            wait = std::max<int>(0, timeout * 1000 - elapsed.count());
+        }
+        int ready = poll(fds.data(), fds.size(), wait);
+        if (ready == 0)
+        {
+            status = SearchResult::NotFound;
+            break; // timed out
+        }
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready < 0)
+        {
+            status = SearchResult::Error;
+            break; // the jobs are killed below
+        }
+
+        for (size_t i = 0; i != fds.size(); i++)
+        {
+            if (fds[i].fd < 0 || !fds[i].revents)
+                continue;
+            char buf[4096];
+            ssize_t k = read(fds[i].fd, buf, sizeof(buf));
+            if (k > 0)
+            {
+                msgs[i].append(buf, k);
+                continue;
+            }
+            // End of this job's output
+            close(fds[i].fd);
+            fds[i].fd = -1;
+            open--;
+            SearchResult r = decode(t, initial, msgs[i]);
+            if (r.status == SearchResult::Found || r.status == SearchResult::Refuted)
+            {
+                answer.emplace(r);
+                winner = jobs[i].name;
+                break;
+            }
+            if (r.status == SearchResult::NotFound)
+                status = SearchResult::NotFound;
+        }
+        if (answer)
+            break;
+    }
+
+    cancel();
+    if (answer)
+        return *answer;
+    return {status, {}};
+}
+
+SearchResult within_bounds(const SearchResult &res, const int &steps, const int &depth)
+{
+    if (res.status != SearchResult::Found)
+        return res;
+    bool deep = res.steps.size() > steps;
+    for (auto &&s : res.steps)
+        deep = deep || s.path.size() > depth;
+    if (deep)
+        return {SearchResult::NotFound, {}};
+    return res;
+}
@@ -0,0 +1,55 @@
+#ifndef PORTFOLIO
+#define PORTFOLIO
+
+/*
+ * Run several search configurations for the same query concurrently
+ */
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "rewrite.hpp"
+
+/**
+ * One configuration of a portfolio: a search which is run in its own process
+ */
+struct Job
+{
+public:
+    // For reporting which configuration answered
+    std::string name;
+    std::function<SearchResult()> run;
+};
+
+/**
+ * Run jobs in parallel, each in a forked process, and return the first
+ * definitive answer (Found or Refuted); the other processes are killed.
+ *
+ * Witnesses are sent back as rule/direction/path triples and replayed on
+ * the initial term, so every job must search with the same theory.
+ *
+ * @param t Theory (upgraded)
+ * @param initial Starting term of every job (upgraded)
+ * @param jobs Configurations to race
+ * @param timeout Seconds after which every job is killed (0 means no limit)
+ * @param winner Set to the name of the job whose answer is returned
+ * @returns The first definitive answer, otherwise NotFound (or Error if every job failed)
+ */
+SearchResult portfolio(const Theory &t,
+                       const Expr &initial,
+                       const std::vector<Job> &jobs,
+                       const int &timeout,
+                       std::string &winner);
+
+/**
+ * Hold a job's witness to the bounds of the query, so that every job of a
+ * portfolio answers the same question whichever finishes first
+ * @param res Result of an engine which is not bounded itself (e.g. egraph)
+ * @param steps Max number of rewrite steps
+ * @param depth Max length of the path of a step
+ * @returns res, except NotFound if it was Found with a longer witness or a
+ *          deeper step
+ */
+SearchResult within_bounds(const SearchResult &res, const int &steps, const int &depth);
+
+#endif
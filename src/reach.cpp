@@ -0,0 +1,317 @@
+#include <cstdio>
+#include "pattern.hpp"
+#include "reach.hpp"
+
+namespace
+{
+    // Tokens with no arguments
+    const std::set<std::pair<Sym, int>> none;
+
+    // Order-independent digest of strings (Sym ids differ between runs)
+    struct Digest
+    {
+        uint64_t sum = 0;
+
+        void add(const std::string &s)
+        {
+            // FNV-1a
+            uint64_t h = 14695981039346656037ull;
+            for (auto &&c : s)
+            {
+                h ^= static_cast<unsigned char>(c);
+                h *= 1099511628211ull;
+            }
+            sum += h;
+        }
+    };
+
+    std::string show(const std::pair<Sym, int> &tok)
+    {
+        return tok.first.str() + "/" + std::to_string(tok.second);
+    }
+}
+
+Reach::Reach(const Theory &t, const int &depth, const Ve &initial) : depth(depth)
+{
+    const int nrd = 2 * t.rules.size();
+    for (auto &&r : t.rules)
+    {
+        inputs.push_back(r.t1);
+        inputs.push_back(r.t2);
+    }
+
+    // The grammar of the initial terms
+    for (auto &&x : initial)
+    {
+        roots.insert({x.sym, static_cast<int>(x.args.size())});
+        Positions pos = x.positions();
+        for (size_t i = 1; i != pos.size(); i++)
+        {
+            const Expr &par = pos.terms.at(pos.parent.at(i));
+            add({par.sym, static_cast<int>(par.args.size())},
+                pos.argi.at(i),
+                {pos.terms.at(i).sym, static_cast<int>(pos.terms.at(i).args.size())});
+        }
+    }
+
+    // Tokens at each depth (of the grammar as it currently is)
+    auto levels = [&]() {
+        std::vector<std::set<Token>> res{roots};
+        for (int k = 1; k <= depth; k++)
+        {
+            std::set<Token> next;
+            for (auto &&tok : res.back())
+            {
+                for (int i = 0; i != tok.second; i++)
+                    next.insert(kids(tok, i).begin(), kids(tok, i).end());
+            }
+            res.push_back(next);
+        }
+        return res;
+    };
+
+    fire.assign(depth + 1, std::vector<bool>(nrd, false));
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        Memo memo;
+        std::vector<std::set<Token>> lv = levels();
+
+        // Every token, for the possible roots of copied subterms
+        std::set<Token> all;
+        for (auto &&[tok, v] : children)
+        {
+            all.insert(tok);
+            for (auto &&s : v)
+                all.insert(s.begin(), s.end());
+        }
+        all.insert(roots.begin(), roots.end());
+
+        for (int rd = 0; rd != nrd; rd++)
+        {
+            const Pattern &pat = t.program(rd / 2 + 1, rd % 2 == 0);
+            const Expr &src = inputs.at(rd);
+            for (int k = 0; k <= depth; k++)
+            {
+                std::set<Token> matched;
+                for (auto &&tok : lv.at(k))
+                {
+                    if (fits(src, tok, memo))
+                        matched.insert(tok);
+                }
+                if (matched.empty())
+                    continue;
+                fire.at(k).at(rd) = true;
+
+                // Run the output plan on sets of tokens
+                std::vector<std::set<Token>> stack;
+                for (auto &&b : pat.plan)
+                {
+                    if (b.op == Pattern::Build::Copy)
+                    {
+                        std::set<Token> copied;
+                        Expr sub = src.subexpr(b.path);
+                        for (auto &&tok : all)
+                        {
+                            if (fits(sub, tok, memo))
+                                copied.insert(tok);
+                        }
+                        stack.push_back(copied);
+                        continue;
+                    }
+                    Token tok = b.op == Pattern::Build::Fresh ? Token{Sym(), 1} : Token{b.sym, b.nargs};
+                    for (int i = 0; i != b.nargs; i++)
+                    {
+                        for (auto &&kid : stack.at(stack.size() - b.nargs + i))
+                            changed |= add(tok, i, kid);
+                    }
+                    stack.resize(stack.size() - b.nargs);
+                    stack.push_back({tok});
+                }
+
+                // The output takes the place of the matched subterm
+                for (auto &&out : stack.back())
+                {
+                    if (k == 0)
+                        changed |= roots.insert(out).second;
+                    for (auto &&par : k ? lv.at(k - 1) : std::set<Token>{})
+                    {
+                        for (int i = 0; i != par.second; i++)
+                        {
+                            const std::set<Token> &ks = kids(par, i);
+                            for (auto &&m : matched)
+                            {
+                                if (ks.count(m))
+                                {
+                                    changed |= add(par, i, out);
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<std::set<Token>> lv = levels();
+    for (int k = 0; k != depth; k++)
+    {
+        args.push_back({});
+        for (auto &&tok : lv.at(k))
+        {
+            for (int i = 0; i != tok.second; i++)
+            {
+                if (i >= args.back().size())
+                    args.back().resize(i + 1, false);
+                if (!kids(tok, i).empty())
+                    args.back().at(i) = true;
+            }
+        }
+    }
+}
+
+const std::set<Reach::Token> &Reach::kids(const Token &tok, const int &i) const
+{
+    auto it = children.find(tok);
+    if (it == children.end() || i >= it->second.size())
+        return none;
+    return it->second.at(i);
+}
+
+bool Reach::add(const Token &tok, const int &i, const Token &kid)
+{
+    std::vector<std::set<Token>> &v = children[tok];
+    if (i >= v.size())
+        v.resize(i + 1);
+    return v.at(i).insert(kid).second;
+}
+
+bool Reach::fits(const Expr &pat, const Token &tok, Memo &memo) const
+{
+    auto key = std::make_pair(pat.id(), tok);
+    auto it = memo.find(key);
+    if (it != memo.end())
+        return it->second;
+
+    // Some possible argument of tok fits each argument of the pattern
+    auto some = [&](const Expr &p, const int &i) {
+        for (auto &&kid : kids(tok, i))
+        {
+            if (fits(p, kid, memo))
+                return true;
+        }
+        return false;
+    };
+
+    bool res;
+    if (pat.kind == Expr::VarNode)
+        res = tok.second >= 1 && some(pat.args.at(0), 0); // only the sort is checked
+    else
+    {
+        res = tok == Token{pat.sym, static_cast<int>(pat.args.size())};
+        for (int i = 0; res && i != pat.args.size(); i++)
+            res = some(pat.args.at(i), i);
+    }
+    memo.insert({key, res});
+    return res;
+}
+
+std::set<Reach::Token> Reach::at(const Vi &p) const
+{
+    std::set<Token> res = roots;
+    for (auto &&i : p)
+    {
+        std::set<Token> next;
+        for (auto &&tok : res)
+            next.insert(kids(tok, i).begin(), kids(tok, i).end());
+        res = next;
+    }
+    return res;
+}
+
+bool Reach::fires(const int &rule, const bool &forward, const int &k) const
+{
+    return k >= 0 && k <= depth && fire.at(k).at(2 * (rule - 1) + (forward ? 0 : 1));
+}
+
+bool Reach::fires(const int &rule, const bool &forward) const
+{
+    for (int k = 0; k <= depth; k++)
+    {
+        if (fires(rule, forward, k))
+            return true;
+    }
+    return false;
+}
+
+bool Reach::everywhere(const int &rule, const bool &forward) const
+{
+    for (int k = 0; k <= depth; k++)
+    {
+        if (!fires(rule, forward, k))
+            return false;
+    }
+    return true;
+}
+
+bool Reach::child(const int &k, const int &j) const
+{
+    return k >= 1 && k <= depth && j >= 0 && j < args.at(k - 1).size() && args.at(k - 1).at(j);
+}
+
+bool Reach::fires_at(const int &rule, const bool &forward, const Vi &p) const
+{
+    if (!fires(rule, forward, p.size()))
+        return false;
+    Memo memo;
+    for (auto &&tok : at(p))
+    {
+        if (fits(inputs.at(2 * (rule - 1) + (forward ? 0 : 1)), tok, memo))
+            return true;
+    }
+    return false;
+}
+
+bool Reach::useful(const Vi &p) const
+{
+    if (p.size() > depth)
+        return false;
+    for (size_t k = 1; k <= p.size(); k++)
+    {
+        if (!child(k, p.at(k - 1)))
+            return false;
+    }
+    for (int rd = 0; rd != inputs.size(); rd++)
+    {
+        if (fires_at(rd / 2 + 1, rd % 2 == 0, p))
+            return true;
+    }
+    return false;
+}
+
+std::string Reach::key() const
+{
+    Digest d;
+    for (auto &&tok : roots)
+        d.add("root " + show(tok));
+    for (auto &&[tok, v] : children)
+    {
+        for (int i = 0; i != v.size(); i++)
+        {
+            for (auto &&kid : v.at(i))
+                d.add(show(tok) + " " + std::to_string(i) + " " + show(kid));
+        }
+    }
+    for (int k = 0; k != fire.size(); k++)
+    {
+        for (int rd = 0; rd != fire.at(k).size(); rd++)
+        {
+            if (fire.at(k).at(rd))
+                d.add("fire " + std::to_string(k) + " " + std::to_string(rd));
+        }
+    }
+    char buf[17];
+    std::snprintf(buf, sizeof buf, "%016llx", static_cast<unsigned long long>(d.sum));
+    return buf;
+}
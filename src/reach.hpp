@@ -0,0 +1,99 @@
+#ifndef REACH
+#define REACH
+
+/*
+ * Static analysis of which rules can ever fire at which positions, used to
+ * leave impossible branches out of the transition encoding
+ */
+
+#include <set>
+#include <string>
+#include "theory.hpp"
+
+/**
+ * Over-approximation of the terms reachable from some initial terms, as a
+ * tree grammar over (symbol, number of arguments) tokens: which tokens may
+ * be at the root, and which may be the i'th argument of each token. It is
+ * the fixpoint of applying every rule direction wherever its input pattern
+ * fits the grammar, adding what its output plan (see pattern.hpp) builds.
+ *
+ * The grammar forgets where in a term a token occurs and that the same
+ * variable must match the same thing twice, which keeps it small; fresh
+ * variables are all one token.
+ */
+struct Reach
+{
+public:
+    // Max length of a rewritten path
+    const int depth;
+
+    /**
+     * @param t Theory (upgraded)
+     * @param depth Max depth at which rewrites are applied
+     * @param initial Terms the rewriting starts from (upgraded)
+     */
+    Reach(const Theory &t, const int &depth, const Ve &initial);
+
+    /**
+     * @returns Whether a rule direction may apply at some path of length k
+     */
+    bool fires(const int &rule, const bool &forward, const int &k) const;
+
+    /**
+     * @returns Whether a rule direction may apply at any path
+     */
+    bool fires(const int &rule, const bool &forward) const;
+
+    /**
+     * @returns Whether a rule direction may apply at any path up to the depth
+     *          (i.e. whether guarding it by the path length would be useless)
+     */
+    bool everywhere(const int &rule, const bool &forward) const;
+
+    /**
+     * @returns Whether a path may go to argument j at its k'th step (from 1)
+     */
+    bool child(const int &k, const int &j) const;
+
+    /**
+     * @returns Whether any rewrite may happen at a path
+     */
+    bool useful(const Vi &p) const;
+
+    /**
+     * @returns Whether a rule direction may apply at a path
+     */
+    bool fires_at(const int &rule, const bool &forward, const Vi &p) const;
+
+    /**
+     * @returns Short digest of the result (e.g. to distinguish cached encodings)
+     */
+    std::string key() const;
+
+private:
+    typedef std::pair<Sym, int> Token;
+    typedef std::map<std::pair<size_t, Token>, bool> Memo;
+
+    // Input pattern of each rule direction, indexed like fire
+    Ve inputs;
+    std::set<Token> roots;
+    std::map<Token, std::vector<std::set<Token>>> children;
+    // By path length, then 2*(rule-1) + (forward ? 0 : 1)
+    std::vector<std::vector<bool>> fire;
+    // Whether some token at each depth has an i'th argument
+    std::vector<std::vector<bool>> args;
+
+    // Possible i'th arguments of a token
+    const std::set<Token> &kids(const Token &tok, const int &i) const;
+
+    // Whether a term of the grammar with tok at its top may match a pattern
+    bool fits(const Expr &pat, const Token &tok, Memo &memo) const;
+
+    // Tokens the subterms at a path may have
+    std::set<Token> at(const Vi &p) const;
+
+    // Add to the grammar, returning whether it grew
+    bool add(const Token &tok, const int &i, const Token &kid);
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include <sstream>
+#include <stdexcept>
+#include "pattern.hpp"
+#include "ruleindex.hpp"
+#include "rewrite.hpp"
+
+/*
+ * Native rewriting with the same semantics as the SMT encoding of astextra.hpp
+ */
+
+std::string path_name(const Vi &p)
+{
+    return p.empty() ? "Empty" : "P" + join(p);
+}
+
+Vi path_from_name(const std::string &s)
+{
+    Vi res;
+    if (s == "Empty")
+        return res;
+    if (s.rfind("(path ", 0) == 0)
+    {
+        // Levels encoding: (path len c1 c2 ...)
+        std::stringstream ss(s.substr(6));
+        int len, c;
+        ss >> len;
+        for (int i = 0; i != len && ss >> c; i++)
+            res.push_back(c);
+        if (res.size() != len)
+            throw std::runtime_error("Not a path: " + s);
+        return res;
+    }
+    if (s.empty() || s.front() != 'P')
+        throw std::runtime_error("Not a path: " + s);
+    for (size_t i = 1; i != s.size(); i++)
+        res.push_back(s.at(i) - '0');
+    return res;
+}
+
+Sym freshvar(const int &step, const int &offset)
+{
+    // Making a Sym from a name takes the symbol table's lock, and searches
+    // ask for the same few names over and over: keep them per thread
+    static thread_local std::vector<Sym> made;
+    const size_t n = std::abs(-10 * step + offset);
+    if (n >= made.size())
+        made.resize(n + 1);
+    if (made[n].empty())
+        made[n] = "FREE" + std::to_string(n);
+    return made[n];
+}
+
+bool has_freevar(const Theory &t, const int &rule, const bool &forward)
+{
+    return t.program(rule, forward).fresh;
+}
+
+// Subterm of x at a path, if there is one
+static const Expr *at(const Expr &x, const Vi &p)
+{
+    const Expr *res = &x;
+    for (auto &&i : p)
+    {
+        if (i >= res->args.size())
+            return nullptr;
+        res = &res->args[i];
+    }
+    return res;
+}
+
+// Run the checks of a rule's program against a term, collecting what its
+// variables are bound to. Variables only match terms that carry their sort
+// as the first argument (i.e. not sorts themselves).
+static bool match(const Pattern &pat, const Expr &x, std::vector<const Expr *> &bound)
+{
+    for (auto &&c : pat.checks)
+    {
+        const Expr *y = at(x, c.path);
+        if (!y || y->sym != c.sym || y->args.size() != c.nargs)
+            return false;
+    }
+    for (auto &&b : pat.binds)
+    {
+        const Expr *y = at(x, b.path);
+        if (!y || y->kind == Expr::SortNode || y->args.empty() || y->args.at(0).kind != Expr::SortNode)
+            return false;
+        if (b.prev >= 0 && *bound.at(b.prev) != *y)
+            return false;
+        bound.push_back(y);
+    }
+    for (auto &&s : pat.same)
+    {
+        const Expr *y = at(x, s.path);
+        if (!y || *y != *at(x, s.rep))
+            return false;
+    }
+    return true;
+}
+
+std::optional<Expr> rewrite_top(const Theory &t,
+                                const Expr &x,
+                                const int &rule,
+                                const bool &forward,
+                                const int &step)
+{
+    const Pattern &pat = t.program(rule, forward);
+    std::vector<const Expr *> bound;
+    if (!match(pat, x, bound))
+        return std::nullopt;
+
+    // Variables only in the target become fresh variables (of the substituted sort)
+    Ve stack;
+    try
+    {
+        for (auto &&b : pat.plan)
+        {
+            if (b.op == Pattern::Build::Copy)
+            {
+                stack.push_back(*at(x, b.path));
+                continue;
+            }
+            Ve args(stack.end() - b.nargs, stack.end());
+            for (int i = 0; i != b.nargs; i++)
+                stack.pop_back();
+            if (b.op == Pattern::Build::Fresh)
+                stack.push_back({freshvar(step, b.code), Expr::VarNode, {args.at(0)}});
+            else
+                stack.push_back({b.sym, b.kind, args});
+        }
+    }
+    catch (const std::runtime_error &)
+    {
+        return std::nullopt; // result is not a well-formed term
+    }
+    return stack.back();
+}
+
+static Expr replace_rec(const Expr &x, const Vi &p, const size_t &i, const Expr &y)
+{
+    if (i == p.size())
+        return y;
+    Ve newargs;
+    for (int j = 0; j != x.args.size(); j++)
+        newargs.push_back(j == p.at(i) ? replace_rec(x.args.at(j), p, i + 1, y) : x.args.at(j));
+    return {x.sym, x.kind, newargs};
+}
+
+Expr replace_at(const Expr &x, const Vi &p, const Expr &y)
+{
+    return replace_rec(x, p, 0, y);
+}
+
+std::optional<Expr> apply_step(const Theory &t,
+                               const Expr &x,
+                               const Step &s,
+                               const int &step)
+{
+    // The path must exist in x
+    const Expr *sub = &x;
+    for (auto &&i : s.path)
+    {
+        if (i >= sub->args.size())
+            return std::nullopt;
+        sub = &sub->args.at(i);
+    }
+    std::optional<Expr> y = rewrite_top(t, *sub, s.rule, s.forward, step);
+    if (!y)
+        return std::nullopt;
+    try
+    {
+        return replace_at(x, s.path, *y);
+    }
+    catch (const std::runtime_error &)
+    {
+        return std::nullopt;
+    }
+}
+
+// Visit every subterm of x up to a certain depth, with its path
+static void rewrites_below(const Theory &t,
+                           const Expr &root,
+                           const Expr &x,
+                           Vi &pth,
+                           const int &step,
+                           const int &depth,
+                           Steps &res)
+{
+    // Only the rules which the index says may match
+    for (auto &&[r, forward] : t.rule_index().candidates(x))
+    {
+        std::optional<Expr> y = rewrite_top(t, x, r, forward, step);
+        if (!y)
+            continue;
+        try
+        {
+            res.push_back({r, forward, pth, replace_at(root, pth, *y)});
+        }
+        catch (const std::runtime_error &)
+        {
+        }
+    }
+    if (pth.size() == depth)
+        return;
+    for (int i = 0; i != x.args.size(); i++)
+    {
+        pth.push_back(i);
+        rewrites_below(t, root, x.args.at(i), pth, step, depth, res);
+        pth.pop_back();
+    }
+}
+
+Steps successors(const Theory &t,
+                 const Expr &x,
+                 const int &step,
+                 const int &depth)
+{
+    Steps res;
+    Vi pth;
+    rewrites_below(t, x, x, pth, step, depth, res);
+    return res;
+}
+
+std::string print_result(const Theory &t,
+                         const Expr &initial,
+                         const SearchResult &res)
+{
+    std::string sep = "\n*******************************************\n";
+    std::stringstream ss;
+    switch (res.status)
+    {
+    case SearchResult::Found:
+        ss << "\n"
+           << res.steps.size() << "-step solution found" << std::endl;
+        ss << "\n\nStarting from " << t.print(initial.uninfer()) << std::endl;
+        for (int i = 0; i != res.steps.size(); i++)
+        {
+            const Step &s = res.steps.at(i);
+            ss << sep << "Step " << i << ": apply R" << s.rule << (s.forward ? "f" : "r") << " ("
+               << (s.forward ? "forward" : "reverse")
+               << ")\n"
+               << t.print(t.rules.at(s.rule - 1), s.forward) << "\nat subpath "
+               << path_name(s.path) << " to yield:\n\t"
+               << t.print(s.result.uninfer()) << std::endl;
+        }
+        break;
+
+    case SearchResult::Refuted:
+        ss << "\nNo rewrite possible" << std::endl;
+        if (!res.invariant.empty())
+            ss << "\nInductive invariant:\n\t" << res.invariant << std::endl;
+        break;
+
+    case SearchResult::Error:
+        ss << "\nError" << std::endl;
+        break;
+
+    case SearchResult::NotFound:
+        ss << "\nNo solution found" << std::endl;
+        break;
+    }
+    return ss.str();
+}
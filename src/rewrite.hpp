@@ -0,0 +1,142 @@
+#ifndef REWRITE
+#define REWRITE
+
+/*
+ * Native (solver-free) rewriting of terms with the rules of a theory,
+ * and the step/rule/path witnesses shared by all the search engines
+ */
+
+#include <vector>
+#include <string>
+#include <optional>
+#include "theory.hpp"
+
+/**
+ * One rewrite step of a witness
+ */
+struct Step
+{
+public:
+    // Which rule (1-indexed, as in the R1f/R1r constructors of the Rule datatype)
+    int rule;
+    // Whether t1 is rewritten to t2 (forward) or t2 to t1 (reverse)
+    bool forward;
+    // Subterm the rule is applied to
+    Vi path;
+    // Whole term after the step
+    Expr result;
+};
+
+typedef std::vector<Step> Steps;
+
+/**
+ * Outcome of searching for a rewrite path between two terms
+ */
+struct SearchResult
+{
+public:
+    typedef enum
+    {
+        Found,    // steps hold a witness
+        Refuted,  // proved that no rewrite sequence exists
+        NotFound, // none found within the bounds
+        Error
+    } Status;
+
+    Status status;
+    Steps steps;
+    // Invariant of the transition system which excludes the final term, as
+    // an SMT term (if Refuted by an engine which provides one)
+    std::string invariant;
+};
+
+/**
+ * Name of a path, as printed for the constructors of the Path datatype
+ * @param p e.g. [1,2]
+ * @returns e.g. P12 (or Empty)
+ */
+std::string path_name(const Vi &p);
+
+/**
+ * Inverse of path_name. Also reads the model value of a path in the
+ * Levels encoding, e.g. (path 2 1 2 0) for P12
+ */
+Vi path_from_name(const std::string &s);
+
+/**
+ * Name of the variable introduced for a free variable of a rule,
+ * consistent with how construct() numbers them (-10*step+offset)
+ * @param step Which rewrite step introduced the variable
+ * @param offset Index of the variable among the rule's free variables
+ */
+Sym freshvar(const int &step, const int &offset);
+
+/**
+ * Whether a rule direction introduces variables not bound by its input pattern
+ * @param t Theory with rewrite rules
+ * @param rule 1-indexed rule
+ * @param forward Direction
+ */
+bool has_freevar(const Theory &t, const int &rule, const bool &forward);
+
+/**
+ * Apply a rewrite rule to the top of a term
+ *
+ * @param t Theory with rewrite rules (should be upgraded, like x)
+ * @param x Term being rewritten
+ * @param rule 1-indexed rule
+ * @param forward Direction
+ * @param step Which rewrite step this is (to name fresh variables)
+ * @returns Result of the rewrite (nothing if the input pattern does not match x)
+ */
+std::optional<Expr> rewrite_top(const Theory &t,
+                                const Expr &x,
+                                const int &rule,
+                                const bool &forward,
+                                const int &step);
+
+/**
+ * Substitute a subterm
+ * @param x Term in which to replace
+ * @param p Location of the subterm (must exist)
+ * @param y Replacement
+ * @returns Copy of x with y at p
+ */
+Expr replace_at(const Expr &x, const Vi &p, const Expr &y);
+
+/**
+ * Every rewrite of a term at positions no deeper than depth
+ *
+ * @param t Theory with rewrite rules
+ * @param x Term being rewritten
+ * @param step Which rewrite step this is
+ * @param depth Max length of paths to the rewritten subterm
+ * @returns Possible next steps
+ */
+Steps successors(const Theory &t,
+                 const Expr &x,
+                 const int &step,
+                 const int &depth);
+
+/**
+ * Apply a step to a term (ignoring s.result)
+ * @param s Rule, direction and path to apply
+ * @param step Which rewrite step this is (to name fresh variables)
+ * @returns The rewritten term (nothing if the rule does not apply at the path)
+ */
+std::optional<Expr> apply_step(const Theory &t,
+                               const Expr &x,
+                               const Step &s,
+                               const int &step);
+
+/**
+ * Render a search result in the same format for every engine
+ * @param t Theory (for printing rules and terms)
+ * @param initial Starting term
+ * @param res Result of a search
+ */
+std::string print_result(const Theory &t,
+                         const Expr &initial,
+                         const SearchResult &res);
+
+#endif
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include "ruleindex.hpp"
+
+namespace
+{
+    // Rule order, forward before reverse
+    bool before(const RuleIndex::Candidate &a, const RuleIndex::Candidate &b)
+    {
+        return a.first != b.first ? a.first < b.first : a.second > b.second;
+    }
+
+    // Preorder of the subterms of x, with the index just past each one's subtree
+    void flatten(const Expr &x, std::vector<const Expr *> &pre, Vi &skip)
+    {
+        size_t i = pre.size();
+        pre.push_back(&x);
+        skip.push_back(0);
+        for (auto &&a : x.args)
+            flatten(a, pre, skip);
+        skip.at(i) = pre.size();
+    }
+}
+
+RuleIndex::RuleIndex() : nodes(1) {}
+
+RuleIndex::RuleIndex(const std::vector<Rule> &rules) : nodes(1)
+{
+    for (int r = 1; r <= rules.size(); r++)
+    {
+        insert(rules.at(r - 1).t1, {r, true});
+        insert(rules.at(r - 1).t2, {r, false});
+    }
+
+    // Top level lookups are answered from one table
+    for (auto &&[tok, n] : nodes.at(0).next)
+    {
+        std::vector<Candidate> &v = bytop[tok];
+        collect(n, v);
+    }
+    if (nodes.at(0).wild >= 0)
+        collect(nodes.at(0).wild, anytop);
+    for (auto &&[_, v] : bytop)
+    {
+        v.insert(v.end(), anytop.begin(), anytop.end());
+        std::sort(v.begin(), v.end(), before);
+    }
+    std::sort(anytop.begin(), anytop.end(), before);
+}
+
+void RuleIndex::insert(const Expr &pat, const Candidate &c)
+{
+    std::vector<const Expr *> pre;
+    Vi skip;
+    flatten(pat, pre, skip);
+
+    int n = 0;
+    for (size_t i = 0; i != pre.size(); i = pre.at(i)->kind == Expr::VarNode ? skip.at(i) : i + 1)
+    {
+        const Expr &x = *pre.at(i);
+        int next;
+        if (x.kind == Expr::VarNode)
+            next = nodes.at(n).wild;
+        else
+        {
+            auto it = nodes.at(n).next.find({x.sym, static_cast<int>(x.args.size())});
+            next = it == nodes.at(n).next.end() ? -1 : it->second;
+        }
+        if (next < 0)
+        {
+            // No reference into nodes is held here: emplace_back may move them
+            next = nodes.size();
+            nodes.emplace_back();
+            if (x.kind == Expr::VarNode)
+                nodes.at(n).wild = next;
+            else
+                nodes.at(n).next.insert({{x.sym, static_cast<int>(x.args.size())}, next});
+        }
+        n = next;
+    }
+    nodes.at(n).leaves.push_back(c);
+}
+
+void RuleIndex::retrieve(const int &n,
+                         const std::vector<const Expr *> &pre,
+                         const Vi &skip,
+                         const size_t &i,
+                         std::vector<Candidate> &res) const
+{
+    const Node &node = nodes.at(n);
+    if (i == pre.size())
+    {
+        res.insert(res.end(), node.leaves.begin(), node.leaves.end());
+        return;
+    }
+    const Expr &x = *pre.at(i);
+    if (node.wild >= 0 && x.kind != Expr::SortNode)
+        retrieve(node.wild, pre, skip, skip.at(i), res);
+    auto it = node.next.find({x.sym, static_cast<int>(x.args.size())});
+    if (it != node.next.end())
+        retrieve(it->second, pre, skip, i + 1, res);
+}
+
+void RuleIndex::collect(const int &n, std::vector<Candidate> &res) const
+{
+    const Node &node = nodes.at(n);
+    res.insert(res.end(), node.leaves.begin(), node.leaves.end());
+    for (auto &&[_, m] : node.next)
+        collect(m, res);
+    if (node.wild >= 0)
+        collect(node.wild, res);
+}
+
+std::vector<RuleIndex::Candidate> RuleIndex::candidates(const Expr &x) const
+{
+    std::vector<const Expr *> pre;
+    Vi skip;
+    flatten(x, pre, skip);
+    std::vector<Candidate> res;
+    retrieve(0, pre, skip, 0, res);
+    std::sort(res.begin(), res.end(), before);
+    return res;
+}
+
+const std::vector<RuleIndex::Candidate> &RuleIndex::candidates(const Sym &sym, const int &nargs) const
+{
+    auto it = bytop.find({sym, nargs});
+    return it == bytop.end() ? anytop : it->second;
+}
+
+size_t RuleIndex::size() const
+{
+    return nodes.size();
+}
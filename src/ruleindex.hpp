@@ -0,0 +1,83 @@
+#ifndef RULEINDEX
+#define RULEINDEX
+
+/*
+ * Discrimination tree over the sides of a theory's rules, to find the rules
+ * which may apply to a term without trying every one of them
+ */
+
+#include <utility>
+#include "theory.hpp"
+
+/**
+ * Every rule side is flattened in preorder to a string of (symbol, number of
+ * arguments) tokens, with a wildcard token for a variable (which stands for
+ * a whole subterm, its sort annotation included), and the strings of all the
+ * sides share their prefixes in a trie.
+ *
+ * Looking up a term walks the trie along its own preorder tokens, also taking
+ * any wildcard edge (skipping the corresponding subterm of the term). The
+ * result over-approximates the rules that match: nonlinear variables and the
+ * sorts of variables are left for the matcher to check.
+ */
+struct RuleIndex
+{
+public:
+    // A 1-indexed rule, and whether it is applied forward (t1 matches)
+    typedef std::pair<int, bool> Candidate;
+
+    RuleIndex();
+
+    /**
+     * Index both sides of every rule
+     */
+    RuleIndex(const std::vector<Rule> &rules);
+
+    /**
+     * @param x Term to be rewritten at its top
+     * @returns The rule directions whose input may match x, ordered by rule
+     *          then forward before reverse (as they are otherwise tried)
+     */
+    std::vector<Candidate> candidates(const Expr &x) const;
+
+    /**
+     * Only use the top symbol of a term (when nothing else is known about it)
+     * @param sym Symbol at the top of the term
+     * @param nargs Number of arguments of the top of the term
+     * @returns Same as candidates(x) would for any x with that top
+     */
+    const std::vector<Candidate> &candidates(const Sym &sym, const int &nargs) const;
+
+    // Number of trie nodes
+    size_t size() const;
+
+private:
+    typedef std::pair<Sym, int> Token;
+
+    struct Node
+    {
+        std::map<Token, int> next;
+        // Edge for a variable (-1 if none)
+        int wild = -1;
+        // Rule sides ending here
+        std::vector<Candidate> leaves;
+    };
+    std::vector<Node> nodes;
+
+    // Candidates by top token, and those whose input is a variable
+    std::map<Token, std::vector<Candidate>> bytop;
+    std::vector<Candidate> anytop;
+
+    void insert(const Expr &pat, const Candidate &c);
+
+    void retrieve(const int &n,
+                  const std::vector<const Expr *> &pre,
+                  const Vi &skip,
+                  const size_t &i,
+                  std::vector<Candidate> &res) const;
+
+    // All leaves at or below a node
+    void collect(const int &n, std::vector<Candidate> &res) const;
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "search.hpp"
+
+/*
+ * Level-synchronous bidirectional BFS with a sharded visited set and
+ * work-stealing expansion of each level
+ */
+
+namespace
+{
+    // How a state was first reached: by applying `how` to `prev`
+    // (for the backward search: `prev` is reached by applying `how` to the state)
+    struct Parent
+    {
+        Expr prev;
+        Step how;
+    };
+
+    // Concurrent map from states to their parents, split into independently locked shards
+    class Visited
+    {
+    public:
+        explicit Visited(const size_t &nshards) : shards(nshards) {}
+
+        // Insert a state if it is new. Returns whether it was.
+        bool insert(const Expr &x, const Parent &p)
+        {
+            Shard &s = shard(x);
+            std::lock_guard<std::mutex> guard(s.lock);
+            return s.map.insert({x, p}).second;
+        }
+
+        bool contains(const Expr &x)
+        {
+            Shard &s = shard(x);
+            std::lock_guard<std::mutex> guard(s.lock);
+            return s.map.find(x) != s.map.end();
+        }
+
+        // Only safe to call when no thread is inserting
+        const Parent &at(const Expr &x)
+        {
+            return shard(x).map.at(x);
+        }
+
+        size_t size()
+        {
+            size_t n = 0;
+            for (auto &&s : shards)
+                n += s.map.size();
+            return n;
+        }
+
+    private:
+        struct Shard
+        {
+            std::mutex lock;
+            std::unordered_map<Expr, Parent> map;
+        };
+        std::deque<Shard> shards;
+
+        Shard &shard(const Expr &x)
+        {
+            return shards[x.hash().lo % shards.size()];
+        }
+    };
+
+    // One worker's share of a frontier. The owner pops from the back,
+    // thieves take from the front.
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<Expr> items;
+
+        std::optional<Expr> pop()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (items.empty())
+                return std::nullopt;
+            Expr x = items.back();
+            items.pop_back();
+            return x;
+        }
+
+        std::optional<Expr> steal()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (items.empty())
+                return std::nullopt;
+            Expr x = items.front();
+            items.pop_front();
+            return x;
+        }
+    };
+
+    // Below this many states a level is expanded on the calling thread
+    const size_t parallel_threshold = 64;
+}
+
+/**
+ * Expand every state of a frontier by one rewrite
+ *
+ * @param mine Visited set of the side being expanded
+ * @param other Visited set of the opposite side (a new state found there is a meeting point)
+ * @param step Step number used to name fresh variables
+ * @param meet Set to a meeting point, if one was found
+ * @returns The next frontier
+ */
+static std::vector<Expr> expand(const Theory &t,
+                                const std::vector<Expr> &frontier,
+                                Visited &mine,
+                                Visited &other,
+                                const int &step,
+                                const int &depth,
+                                const int &nthreads,
+                                std::vector<Expr> &meet)
+{
+    std::mutex outlock;
+    std::vector<Expr> next;
+    std::atomic<bool> met{false};
+
+    auto visit = [&](const Expr &x, std::vector<Expr> &out) {
+        for (auto &&s : successors(t, x, step, depth))
+        {
+            if (!mine.insert(s.result, {x, s}))
+                continue;
+            out.push_back(s.result);
+            if (other.contains(s.result) && !met.exchange(true))
+            {
+                std::lock_guard<std::mutex> guard(outlock);
+                meet.push_back(s.result);
+            }
+        }
+    };
+
+    if (nthreads <= 1 || frontier.size() < parallel_threshold)
+    {
+        for (auto &&x : frontier)
+        {
+            visit(x, next);
+            if (met)
+                break;
+        }
+        return next;
+    }
+
+    // Deal the frontier round-robin into per-worker queues
+    std::deque<WorkQueue> queues(nthreads);
+    for (size_t i = 0; i != frontier.size(); i++)
+        queues[i % nthreads].items.push_back(frontier[i]);
+
+    // Own work first, then steal from the others in turn
+    auto take = [&](const int &me) -> std::optional<Expr> {
+        for (int k = 0; k != nthreads; k++)
+        {
+            std::optional<Expr> x = k ? queues[(me + k) % nthreads].steal() : queues[me].pop();
+            if (x)
+                return x;
+        }
+        return std::nullopt;
+    };
+
+    auto work = [&](const int &me) {
+        std::vector<Expr> out;
+        while (!met)
+        {
+            std::optional<Expr> x = take(me);
+            if (!x)
+                break; // every queue is empty
+            visit(*x, out);
+        }
+        std::lock_guard<std::mutex> guard(outlock);
+        for (auto &&y : out)
+            next.push_back(y);
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i != nthreads; i++)
+        pool.emplace_back(work, i);
+    for (auto &&th : pool)
+        th.join();
+    return next;
+}
+
+SearchResult native_search(const Theory &t,
+                           const Expr &initial,
+                           const Expr &final,
+                           const int &steps,
+                           const int &depth,
+                           const int &threads,
+                           const size_t &max_states)
+{
+    int nthreads = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+
+    // Backward search is only exact when no rule direction invents variables
+    bool bidirectional = true;
+    for (int r = 1; r <= t.rules.size(); r++)
+        bidirectional &= !has_freevar(t, r, true) && !has_freevar(t, r, false);
+
+    if (initial == final)
+        return {SearchResult::Found, {}};
+
+    Visited fwd(4 * nthreads), bwd(4 * nthreads);
+    Step none{0, true, {}, initial};
+    fwd.insert(initial, {initial, none});
+    bwd.insert(final, {final, none});
+    std::vector<Expr> ffront{initial}, bfront{final}, meet;
+    int fdist = 0, bdist = 0;
+
+    while (fdist + bdist < steps && meet.empty())
+    {
+        if (bidirectional && bfront.size() < ffront.size())
+        {
+            bfront = expand(t, bfront, bwd, fwd, bdist, depth, nthreads, meet);
+            bdist++;
+        }
+        else
+        {
+            ffront = expand(t, ffront, fwd, bwd, fdist, depth, nthreads, meet);
+            fdist++;
+        }
+        if (ffront.empty() || bfront.empty())
+            break; // the reachable space is exhausted
+        if (max_states && fwd.size() + bwd.size() > max_states)
+            break;
+    }
+    if (meet.empty())
+        return {SearchResult::NotFound, {}};
+
+    // Walk from the meeting point back to the initial term...
+    std::vector<Step> fsteps;
+    for (const Expr *x = &meet.front(); *x != initial;)
+    {
+        const Parent &p = fwd.at(*x);
+        fsteps.push_back(p.how);
+        x = &p.prev;
+    }
+    // ...and forward to the final term, inverting the backward steps
+    std::vector<Step> bsteps;
+    for (const Expr *x = &meet.front(); *x != final;)
+    {
+        const Parent &p = bwd.at(*x);
+        bsteps.push_back({p.how.rule, !p.how.forward, p.how.path, p.prev});
+        x = &p.prev;
+    }
+
+    // Replay the witness to give each step its true step number
+    Steps witness;
+    for (size_t i = fsteps.size(); i--;)
+        witness.push_back(fsteps[i]);
+    for (auto &&s : bsteps)
+        witness.push_back(s);
+
+    Steps res;
+    std::vector<Expr> curr{initial};
+    for (int i = 0; i != witness.size(); i++)
+    {
+        std::optional<Expr> y = apply_step(t, curr.back(), witness[i], i);
+        if (!y)
+            return {SearchResult::Error, {}};
+        res.push_back({witness[i].rule, witness[i].forward, witness[i].path, *y});
+        curr.push_back(*y);
+    }
+    if (curr.back() != final)
+        return {SearchResult::Error, {}};
+    return {SearchResult::Found, res};
+}
@@ -0,0 +1,38 @@
+#ifndef SEARCH
+#define SEARCH
+
+/*
+ * Explicit-state search for rewrite paths, without a solver
+ */
+
+#include "rewrite.hpp"
+
+/**
+ * Bidirectional breadth-first search for a rewrite path between two terms.
+ *
+ * Rewrites follow the same semantics and bounds as the BMC encoding: at most
+ * `steps` rewrites, each at a subterm whose path has length at most `depth`.
+ * When no rule introduces free variables, the search expands whichever of the
+ * forward (from initial) and backward (from final) frontiers is smaller;
+ * otherwise fresh variable names depend on the step number, so only the
+ * forward direction is searched. Each BFS level is expanded by a pool of
+ * threads which steal work from each other's share of the frontier.
+ *
+ * @param t Theory (upgraded)
+ * @param initial Starting term (upgraded)
+ * @param final Goal term (upgraded)
+ * @param steps Max number of rewrites
+ * @param depth Max depth at which rewrites are applied
+ * @param threads Number of worker threads (0 means one per core)
+ * @param max_states Give up (NotFound) after visiting this many states (0 means no limit)
+ * @returns A shortest witness, if one exists within the bounds
+ */
+SearchResult native_search(const Theory &t,
+                           const Expr &initial,
+                           const Expr &final,
+                           const int &steps,
+                           const int &depth,
+                           const int &threads = 0,
+                           const size_t &max_states = 0);
+
+#endif
@@ -0,0 +1,339 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "snapshot.hpp"
+
+/*
+ * A snapshot is a header followed by tables, all integers being native
+ * 32-bit words (64-bit for hashes) and strings a length then their bytes:
+ *   magic version source-hash theory-hash name
+ *   nsyms  string...                          symbols used by any node
+ *   nnodes (sym kind nargs arg...)...         every distinct Expr, in postorder
+ *   nsorts (sym pat desc nargs arg...)...
+ *   nops   (sym pat desc sort nargs arg...)...
+ *   nrules (name desc t1 t2)...
+ * Nodes refer to symbols and earlier nodes by index, so that shared subterms
+ * are stored once and loading interns each of them once.
+ */
+
+// Bump whenever the file format changes, and also whenever the output of
+// Theory::upgrade changes: a snapshot stores upgraded theories, and nothing
+// else tells one made by an older upgrade apart (the stored Theory::hash is
+// of the snapshot's own contents, so it still matches)
+static const uint32_t snapshot_version = 1;
+
+static const char snapshot_magic[8] = {'g', 'a', 't', 's', 'n', 'a', 'p', '\0'};
+
+namespace
+{
+    struct Writer
+    {
+        std::string buf;
+        std::unordered_map<int, uint32_t> syms;
+        std::vector<Sym> symlist;
+        std::unordered_map<size_t, uint32_t> nodes;
+        std::string nodebuf;
+
+        void raw(const void *p, const size_t &n)
+        {
+            buf.append(static_cast<const char *>(p), n);
+        }
+        void u32(const uint32_t &v) { raw(&v, sizeof(v)); }
+        void u64(const uint64_t &v) { raw(&v, sizeof(v)); }
+        void str(const std::string &s)
+        {
+            u32(s.size());
+            raw(s.data(), s.size());
+        }
+
+        uint32_t sym(const Sym &s)
+        {
+            auto it = syms.find(s.id());
+            if (it != syms.end())
+                return it->second;
+            symlist.push_back(s);
+            return syms[s.id()] = symlist.size() - 1;
+        }
+
+        // Add a node (after its args) to the node table
+        uint32_t node(const Expr &e)
+        {
+            auto it = nodes.find(e.id());
+            if (it != nodes.end())
+                return it->second;
+            std::vector<uint32_t> args;
+            for (auto &&a : e.args)
+                args.push_back(node(a));
+            uint32_t words[3] = {sym(e.sym), static_cast<uint32_t>(e.kind), static_cast<uint32_t>(args.size())};
+            nodebuf.append(reinterpret_cast<const char *>(words), sizeof(words));
+            nodebuf.append(reinterpret_cast<const char *>(args.data()), args.size() * sizeof(uint32_t));
+            uint32_t i = nodes.size();
+            nodes[e.id()] = i;
+            return i;
+        }
+    };
+
+    // Bounds-checked reads from a mapped file
+    struct Reader
+    {
+        const char *data;
+        size_t size;
+        size_t pos = 0;
+
+        const char *take(const size_t &n)
+        {
+            if (n > size - pos)
+                throw std::runtime_error("Truncated snapshot");
+            const char *p = data + pos;
+            pos += n;
+            return p;
+        }
+        uint32_t u32()
+        {
+            uint32_t v;
+            std::memcpy(&v, take(sizeof(v)), sizeof(v));
+            return v;
+        }
+        uint64_t u64()
+        {
+            uint64_t v;
+            std::memcpy(&v, take(sizeof(v)), sizeof(v));
+            return v;
+        }
+        // Number of entries of a table with at least `each` bytes per entry
+        uint32_t count(const size_t &each)
+        {
+            uint32_t n = u32();
+            if (n > (size - pos) / each)
+                throw std::runtime_error("Truncated snapshot");
+            return n;
+        }
+        std::string str()
+        {
+            uint32_t n = u32();
+            return std::string(take(n), n);
+        }
+        Hash128 hash()
+        {
+            uint64_t hi = u64();
+            return {hi, u64()};
+        }
+    };
+
+    // Read-only mapping of a whole file, released on destruction
+    struct Mapping
+    {
+        const char *data = nullptr;
+        size_t size = 0;
+
+        Mapping(const std::string &path)
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0)
+            {
+                void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED)
+                {
+                    data = static_cast<const char *>(p);
+                    size = st.st_size;
+                }
+            }
+            close(fd);
+        }
+        ~Mapping()
+        {
+            if (data)
+                munmap(const_cast<char *>(data), size);
+        }
+        Mapping(const Mapping &) = delete;
+        Mapping &operator=(const Mapping &) = delete;
+    };
+}
+
+bool save_snapshot(const Theory &t, const Hash128 &source, const std::string &path)
+{
+    // Sorts, ops and rules first, since they fill the node table
+    Writer w;
+    std::string decls;
+    std::swap(w.buf, decls);
+    auto nodes = [&](const Ve &xs) {
+        w.u32(xs.size());
+        for (auto &&x : xs)
+            w.u32(w.node(x));
+    };
+    w.u32(t.sorts.size());
+    for (auto &&[k, v] : t.sorts)
+    {
+        w.u32(w.sym(k));
+        w.str(v.pat);
+        w.str(v.desc);
+        nodes(v.args);
+    }
+    w.u32(t.ops.size());
+    for (auto &&[k, v] : t.ops)
+    {
+        w.u32(w.sym(k));
+        w.str(v.pat);
+        w.str(v.desc);
+        w.u32(w.node(v.sort));
+        nodes(v.args);
+    }
+    w.u32(t.rules.size());
+    for (auto &&r : t.rules)
+    {
+        w.str(r.name);
+        w.str(r.desc);
+        w.u32(w.node(r.t1));
+        w.u32(w.node(r.t2));
+    }
+    std::swap(w.buf, decls);
+
+    Hash128 h = t.hash();
+    w.raw(snapshot_magic, sizeof(snapshot_magic));
+    w.u32(snapshot_version);
+    w.u64(source.hi);
+    w.u64(source.lo);
+    w.u64(h.hi);
+    w.u64(h.lo);
+    w.str(t.name);
+    w.u32(w.symlist.size());
+    for (auto &&s : w.symlist)
+        w.str(s.str());
+    w.u32(w.nodes.size());
+    w.buf += w.nodebuf;
+    w.buf += decls;
+
+    // Write to a temporary file first so that readers never see half a snapshot
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+    bool ok;
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        out.write(w.buf.data(), w.buf.size());
+        ok = out.good();
+    }
+    if (ok)
+        std::filesystem::rename(tmp, path);
+    else
+        std::filesystem::remove(tmp);
+    return ok;
+}
+
+std::optional<Theory> load_snapshot(const Hash128 &source, const std::string &path)
+{
+    Mapping m(path);
+    if (!m.data)
+        return std::nullopt;
+    Reader r{m.data, m.size};
+    try
+    {
+        if (std::memcmp(r.take(sizeof(snapshot_magic)), snapshot_magic, sizeof(snapshot_magic)) ||
+            r.u32() != snapshot_version || r.hash() != source)
+            return std::nullopt;
+        Hash128 h = r.hash();
+        std::string name = r.str();
+
+        std::vector<Sym> syms(r.count(sizeof(uint32_t)));
+        for (auto &&s : syms)
+            s = Sym(r.str());
+
+        // Every node's args precede it, so each one is interned exactly once
+        Ve nodes;
+        const uint32_t nnodes = r.count(3 * sizeof(uint32_t));
+        nodes.reserve(nnodes);
+        for (uint32_t i = 0; i != nnodes; i++)
+        {
+            Sym s = syms.at(r.u32());
+            uint32_t kind = r.u32();
+            if (kind > Expr::SortNode)
+                return std::nullopt;
+            Ve args;
+            for (uint32_t n = r.u32(); n; n--)
+                args.push_back(nodes.at(r.u32()));
+            nodes.push_back(Expr(s, static_cast<Expr::NodeType>(kind), args));
+        }
+        auto exprs = [&]() {
+            Ve res;
+            for (uint32_t n = r.u32(); n; n--)
+                res.push_back(nodes.at(r.u32()));
+            return res;
+        };
+
+        std::vector<SortDecl> sorts;
+        for (uint32_t n = r.u32(); n; n--)
+        {
+            Sym s = syms.at(r.u32());
+            std::string pat = r.str(), desc = r.str();
+            sorts.push_back({s, pat, exprs(), desc});
+        }
+        std::vector<OpDecl> ops;
+        for (uint32_t n = r.u32(); n; n--)
+        {
+            Sym s = syms.at(r.u32());
+            std::string pat = r.str(), desc = r.str();
+            Expr sort = nodes.at(r.u32());
+            ops.push_back({s, pat, sort, exprs(), desc});
+        }
+        std::vector<Rule> rules;
+        for (uint32_t n = r.u32(); n; n--)
+        {
+            std::string rname = r.str(), desc = r.str();
+            Expr t1 = nodes.at(r.u32());
+            rules.push_back({rname, desc, t1, nodes.at(r.u32())});
+        }
+        if (r.pos != r.size)
+            return std::nullopt;
+
+        Theory t(name, sorts, ops, rules);
+        // The hashes of the nodes are recomputed as they are interned, so this
+        // also catches a change of the hash function since the snapshot was made
+        if (t.hash() != h)
+            return std::nullopt;
+        return t;
+    }
+    catch (const std::exception &)
+    {
+        return std::nullopt;
+    }
+}
+
+std::string snapshot_path(const Hash128 &source, const std::string &dir)
+{
+    return dir + "/" + source.hex() + ".theory";
+}
+
+Theory load_theory(const std::string &pth, const std::string &dir)
+{
+    if (dir.empty())
+        return Theory::parseTheory(pth).upgrade();
+
+    std::ifstream infile(pth, std::ios::binary);
+    if (infile.fail())
+        throw std::runtime_error("Bad path to theory file: " + pth);
+    std::string content((std::istreambuf_iterator<char>(infile)),
+                        (std::istreambuf_iterator<char>()));
+    const Hash128 source = Hash128::of(content);
+    const std::string path = snapshot_path(source, dir);
+
+    // The snapshot is only an optimization: any problem with it means parsing
+    if (std::optional<Theory> t = load_snapshot(source, path))
+        return *t;
+
+    Theory t = Theory::parseTheory(pth).upgrade();
+    try
+    {
+        std::filesystem::create_directories(dir);
+        save_snapshot(t, source, path);
+    }
+    catch (const std::exception &)
+    {
+    }
+    return t;
+}
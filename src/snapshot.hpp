@@ -0,0 +1,46 @@
+#ifndef SNAPSHOT
+#define SNAPSHOT
+
+/*
+ * Binary snapshots of upgraded theories, so that a theory file is parsed and
+ * upgraded once rather than on every run
+ */
+
+#include <optional>
+#include <string>
+#include "theory.hpp"
+
+/**
+ * Write an upgraded theory to a snapshot file
+ * @param t Theory (upgraded)
+ * @param source Hash of the contents of the file the theory was read from
+ * @param path Snapshot file
+ * @returns Whether it was written
+ */
+bool save_snapshot(const Theory &t, const Hash128 &source, const std::string &path);
+
+/**
+ * Read a snapshot written by save_snapshot (the file is mapped, not copied)
+ * @param source Hash of the contents of the theory file
+ * @param path Snapshot file
+ * @returns The theory, or nothing if the file is missing, damaged, of another
+ *          format version or of another source
+ */
+std::optional<Theory> load_snapshot(const Hash128 &source, const std::string &path);
+
+/**
+ * Same as Theory::parseTheory(pth).upgrade(), but saved as a snapshot in
+ * `dir` keyed by the contents of the file, and loaded from there instead of
+ * being parsed again while the file is unchanged.
+ * @param pth Theory file
+ * @param dir Snapshot directory (empty to always parse)
+ */
+Theory load_theory(const std::string &pth, const std::string &dir = "build/cache");
+
+/**
+ * @returns Where load_theory keeps the snapshot of a theory file
+ * @param source Hash of the contents of the file
+ */
+std::string snapshot_path(const Hash128 &source, const std::string &dir);
+
+#endif
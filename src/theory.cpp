@@ -3,25 +3,116 @@
 #include <sstream>
 #include <fstream>
 #include <regex>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cctype>
+#include <optional>
+#include <string_view>
 
 #include "theory.hpp"
+#include "pattern.hpp"
+#include "ruleindex.hpp"
 
-// Safe constructor
-Expr::Expr(const std::string s,
-           const Expr::NodeType k,
-           const std::vector<Expr> a) : sym(s), kind(k), args(a)
+namespace
+{
+    // Global symbol table. Like the node store, entries are never moved or freed.
+    std::deque<std::string> symnames{""};
+    std::unordered_map<std::string, int> symindex{{"", 0}};
+    std::mutex symlock;
+    // Name of the empty symbol, taken once before any other thread can grow symnames
+    const std::string *const emptyname = &symnames.front();
+}
+
+Sym::Sym() : i(0), name(emptyname) {}
+
+Sym::Sym(const char *s) : Sym(std::string(s)) {}
+
+Sym::Sym(const std::string &s)
+{
+    std::lock_guard<std::mutex> guard(symlock);
+    auto it = symindex.find(s);
+    if (it == symindex.end())
+    {
+        symnames.push_back(s);
+        it = symindex.insert({s, symnames.size() - 1}).first;
+    }
+    i = it->second;
+    name = &symnames.at(i);
+}
+
+int Sym::id() const
+{
+    return i;
+}
+
+const std::string &Sym::str() const
+{
+    return *name;
+}
+
+bool Sym::empty() const
+{
+    return i == 0;
+}
+
+bool Sym::operator==(const Sym &that) const
+{
+    return i == that.i;
+}
+
+bool Sym::operator!=(const Sym &that) const
+{
+    return i != that.i;
+}
+
+bool Sym::operator<(const Sym &that) const
+{
+    return i < that.i;
+}
+
+std::ostream &operator<<(std::ostream &out, const Sym &s)
+{
+    return out << s.str();
+}
+
+int Sym::count()
+{
+    std::lock_guard<std::mutex> guard(symlock);
+    return symnames.size();
+}
+
+Sym Sym::byid(const int &i)
 {
-    validate_expr();
+    Sym res;
+    std::lock_guard<std::mutex> guard(symlock);
+    if (i > 0 && i < symnames.size())
+    {
+        res.i = i;
+        res.name = &symnames.at(i);
+    }
+    return res;
 }
 
-void Expr::validate_expr()
+// Safe constructor
+Expr::Expr(const Sym s,
+           const Expr::NodeType k,
+           const std::vector<Expr> a) : node(intern(s, k, a)),
+                                        sym(node->sym),
+                                        kind(node->kind),
+                                        args(node->args) {}
+
+void Expr::validate_expr(const Sym &sym, const NodeType &kind, const Ve &args)
 {
     if (sym.empty())
         throw std::runtime_error("Expr is empty");
     else if (kind == Expr::VarNode)
     {
         if (args.size() != 1)
-            throw std::runtime_error("Var '" + sym + "' has " + std::to_string(args.size()) + " != 1 args");
+            throw std::runtime_error("Var '" + sym.str() + "' has " + std::to_string(args.size()) + " != 1 args");
         else if (args.at(0).kind != Expr::SortNode)
             throw std::runtime_error("Var arg is not sort");
     }
@@ -43,9 +134,182 @@ void Expr::validate_expr()
     }
 }
 
+namespace
+{
+    // Identity of a node: its symbol, kind and the ids of its (already interned) args
+    struct NodeKey
+    {
+        int sym;
+        int kind;
+        std::vector<size_t> args;
+        // Of the above, computed once as it picks the shard too
+        size_t hash = 0;
+
+        void rehash()
+        {
+            // Multiply and fold each word in: ids are small and close together,
+            // which a shift-and-add combination left colliding
+            hash = (sym * 0x9e3779b97f4a7c15ULL) ^ kind;
+            for (auto &&a : args)
+            {
+                hash = (hash ^ a) * 0xff51afd7ed558ccdULL;
+                hash ^= hash >> 32;
+            }
+        }
+
+        bool operator==(const NodeKey &that) const
+        {
+            return kind == that.kind && args == that.args && sym == that.sym;
+        }
+    };
+
+    struct NodeKeyHash
+    {
+        size_t operator()(const NodeKey &k) const
+        {
+            return k.hash;
+        }
+    };
+
+    // Global node index, split by key hash so that threads building terms
+    // rarely wait for each other
+    struct NodeShard
+    {
+        std::unordered_map<NodeKey, const ExprNode *, NodeKeyHash> index;
+        std::mutex lock;
+    };
+    const size_t nshards = 64; // 2^6, see intern
+    NodeShard shards[nshards];
+    std::atomic<size_t> nodecount{0};
+
+    // Nodes are stored where the thread which first interned them put them,
+    // so that the nodes of a term stay close together. A deque never moves
+    // its elements, and a thread's deque outlives it, so handles stay valid.
+    std::deque<ExprNode> &arena()
+    {
+        static thread_local std::deque<ExprNode> *nodes = new std::deque<ExprNode>;
+        return *nodes;
+    }
+}
+
+bool Hash128::operator==(const Hash128 &that) const
+{
+    return hi == that.hi && lo == that.lo;
+}
+
+bool Hash128::operator!=(const Hash128 &that) const
+{
+    return !(*this == that);
+}
+
+bool Hash128::operator<(const Hash128 &that) const
+{
+    return hi < that.hi || (hi == that.hi && lo < that.lo);
+}
+
+std::string Hash128::hex() const
+{
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)hi, (unsigned long long)lo);
+    return buf;
+}
+
+namespace
+{
+    // Finalizer of MurmurHash3: a bijective avalanche of 64 bits
+    uint64_t fmix64(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    // Two independently seeded 64-bit lanes absorbing a stream of words
+    struct Hasher
+    {
+        uint64_t a = 0x6a09e667f3bcc908ULL, b = 0xbb67ae8584caa73bULL;
+
+        void add(const uint64_t &v)
+        {
+            a = fmix64(a ^ v) + 0x9e3779b97f4a7c15ULL;
+            b = fmix64((b + v) * 0xc2b2ae3d27d4eb4fULL) ^ (b >> 29);
+        }
+        void add(const std::string &s)
+        {
+            add(s.size());
+            for (size_t i = 0; i < s.size(); i += 8)
+            {
+                uint64_t w = 0;
+                for (size_t j = i; j != std::min(i + 8, s.size()); j++)
+                    w = (w << 8) | (unsigned char)s[j];
+                add(w);
+            }
+        }
+    };
+
+    // Hash of a node from its symbol, kind, and the (already computed) hashes of its args
+    Hash128 structural_hash(const Sym &s, const Expr::NodeType &k, const Ve &a)
+    {
+        Hasher h;
+        h.add(s.str());
+        h.add(k);
+        h.add(a.size());
+        for (auto &&x : a)
+        {
+            h.add(x.hash().hi);
+            h.add(x.hash().lo);
+        }
+        return {h.a, h.b};
+    }
+}
+
+Hash128 Hash128::of(const std::string &bytes)
+{
+    Hasher h;
+    h.add(bytes);
+    return {h.a, h.b};
+}
+
+const ExprNode *Expr::intern(const Sym &s, const NodeType &k, const Ve &a)
+{
+    validate_expr(s, k, a);
+
+    NodeKey key{s.id(), k, {}};
+    key.args.reserve(a.size());
+    for (auto &&x : a)
+        key.args.push_back(x.id());
+    key.rehash();
+
+    // The top bits, independent of the low bits which pick the bucket in the shard
+    NodeShard &shard = shards[key.hash >> 58];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end())
+        return it->second;
+
+    std::deque<ExprNode> &nodes = arena();
+    nodes.push_back({s, k, a, nodecount++, structural_hash(s, k, a)});
+    const ExprNode *n = &nodes.back();
+    shard.index.insert({std::move(key), n});
+    return n;
+}
+
+size_t Expr::id() const
+{
+    return node->id;
+}
+
+const Hash128 &Expr::hash() const
+{
+    return node->hash;
+}
+
 bool Expr::operator==(const Expr &that) const
 {
-    return sym == that.sym && kind == that.kind && args == that.args;
+    return node == that.node;
 }
 
 bool Expr::operator!=(const Expr &that) const
@@ -96,7 +360,7 @@ std::string Theory::print(const Expr &e) const
 {
 
     if (e.kind == Expr::VarNode)
-        return e.sym + ":" + print(e.args.at(0));
+        return e.sym.str() + ":" + print(e.args.at(0));
     else
     {
         Expr::NodeType firstchild = e.args.size() ? e.args.at(0).kind : Expr::VarNode;
@@ -126,7 +390,7 @@ std::string Theory::print(const SortDecl &x) const
     Vs args;
     for (auto &&a : x.args)
         args.push_back(print(a.uninfer()));
-    return "Sort: " + x.sym + " " + x.pat + "\n\t" + join(args, "\n\t");
+    return "Sort: " + x.sym.str() + " " + x.pat + "\n\t" + join(args, "\n\t");
 }
 
 // Pretty print
@@ -135,7 +399,7 @@ std::string Theory::print(const OpDecl &x) const
     Vs args;
     for (auto &&a : x.args)
         args.push_back(print(a.uninfer()));
-    return "Op: " + x.sym + " " + x.pat + "\n\t" + join(args, "\n\t");
+    return "Op: " + x.sym.str() + " " + x.pat + "\n\t" + join(args, "\n\t");
 }
 
 // Pretty print
@@ -159,10 +423,10 @@ std::string Theory::print(const Rule &x, const int &dir) const
 // Pretty print
 std::string Theory::print(){
     Vs lines;
-    for (auto &&[v, s] : sorts)
-        lines.push_back(print(s));
-    for (auto &&[v, s] : ops)
-        lines.push_back(print(s));
+    for (auto &&k : sorted_syms(sorts))
+        lines.push_back(print(sorts.at(k)));
+    for (auto &&k : sorted_syms(ops))
+        lines.push_back(print(ops.at(k)));
     for (auto &&r : rules)
         lines.push_back(print(r));
 
@@ -218,7 +482,11 @@ OpDeclDict Theory::make_odict(std::vector<OpDecl> o)
     return odict;
 }
 
-Theory::Theory() : name("Default"), sorts({}), ops({}), rules({}) {}
+Theory::Theory() : name("Default"), sorts({}), ops({}), rules({}),
+                   codes(mk_symcode()),
+                   programs(mk_programs()),
+                   ruleindex(std::make_shared<RuleIndex>(rules)),
+                   termparser(std::make_shared<TermParser>()) {}
 
 Theory::Theory(const std::string n,
                const std::vector<SortDecl> s,
@@ -226,7 +494,11 @@ Theory::Theory(const std::string n,
                const std::vector<Rule> r) : name(n),
                                             sorts(make_sdict(s)),
                                             ops(make_odict(o)),
-                                            rules(r)
+                                            rules(r),
+                                            codes(mk_symcode()),
+                                            programs(mk_programs()),
+                                            ruleindex(std::make_shared<RuleIndex>(rules)),
+                                            termparser(std::make_shared<TermParser>())
 {
     validate_theory();
 }
@@ -234,165 +506,233 @@ Theory::Theory(const std::string n,
 Theory::Theory(const std::string n,
                const SortDeclDict s,
                const OpDeclDict o,
-               const std::vector<Rule> r) : name(n), sorts(s), ops(o), rules(r) { validate_theory(); }
-
-// Create AST with PEGlib, then parse it
-Theory Theory::parseTheory(const std::string pth)
+               const std::vector<Rule> r) : name(n), sorts(s), ops(o), rules(r),
+                                            codes(mk_symcode()),
+                                            programs(mk_programs()),
+                                            ruleindex(std::make_shared<RuleIndex>(rules)),
+                                            termparser(std::make_shared<TermParser>())
 {
-    peg::parser parser(R"(
-Items <- WORD Item*
-Item <- SortDecl / OpDecl / Rule
-SortDecl <- 'Sort' WORD PHRASE PHRASE '[' Term* ']'
-OpDecl <- 'Op' WORD PHRASE PHRASE Term '[' Term* ']'
-Rule <- 'Rule' WORD PHRASE Term Term
-Term <- Var / WORD '(' Term* ')' / WORD / '[[' Term '|' Term ']]'
-Var <- WORD ':' Term
-WORD <- < [a-zA-Z_] [a-zA-Z0-9_]* >
-PHRASE <- < '"' (!'"' .)* '"' >
-%whitespace  <-  [ \t\r\n,]*
-)");
-    // Confirm PEGlib parsed the parser correctly
-    assert((bool)parser == true);
-    parser.enable_ast();
-    parser.enable_packrat_parsing();
-
-    // Validate path to file containing the GAT
-    std::ifstream infile(pth);
-    if (infile.fail())
-    {
-        infile.close();
-        throw std::runtime_error("Bad path to theory file: " + pth);
-    }
+    validate_theory();
+}
 
-    // Feed the file to the parser and process the AST
-    std::string content((std::istreambuf_iterator<char>(infile)),
-                        (std::istreambuf_iterator<char>()));
-    std::shared_ptr<peg::Ast> ast;
-    if (parser.parse(content.c_str(), ast))
+namespace
+{
+    /**
+     * Recursive descent parser of theory files, reading views of the file
+     * contents in place. The grammar is
+     *   Items    <- WORD Item*
+     *   Item     <- SortDecl / OpDecl / Rule
+     *   SortDecl <- 'Sort' WORD PHRASE PHRASE '[' Term* ']'
+     *   OpDecl   <- 'Op' WORD PHRASE PHRASE Term '[' Term* ']'
+     *   Rule     <- 'Rule' WORD PHRASE Term Term
+     *   Term     <- WORD ':' Term / WORD '(' Term* ')' / WORD / '[[' Term '|' Term ']]'
+     *   WORD     <- [a-zA-Z_] [a-zA-Z0-9_]*
+     *   PHRASE   <- '"' (!'"' .)* '"'
+     * with spaces, tabs, newlines and commas between tokens.
+     *
+     * Symbols may be used before they are declared, so the file is read twice:
+     * first only to collect which symbols are sorts and which are operators,
+     * then to build the declarations and rules.
+     */
+    struct TheoryReader
     {
-        ast = peg::AstOptimizer(true).optimize(ast);
-
-        // Parse the theory name
-        std::string name = ast->nodes.at(0)->token;
-
-        // Top-level scan of AST to initialize mapping of symbols to
-        // whether they should be parsed as sorts or operators.
-        KindDict kinddict;
+        const std::string &pth;
+        std::string_view src;
+        size_t pos = 0;
+        // Whether this is the first pass, which builds no terms
+        bool declaring = true;
+        KindDict kinds;
+        std::string name;
+        std::vector<SortDecl> sorts;
+        std::vector<OpDecl> ops;
+        std::vector<Rule> rules;
 
-        for (int i = 1; i < ast->nodes.size(); i++)
+        [[noreturn]] void fail(const std::string &expected) const
         {
-            std::shared_ptr<peg::Ast> item = ast->nodes.at(i);
-            if (item->name == "SortDecl")
-            { // Terms with this symbol should be parsed as sorts
-                kinddict.insert({item->nodes.at(0)->token, Expr::SortNode});
-            }
-            if (item->name == "OpDecl")
-            { // Terms with this symbol should be parsed as applications
-                kinddict.insert({item->nodes.at(0)->token, Expr::AppNode});
-            }
+            size_t line = 1 + std::count(src.begin(), src.begin() + pos, '\n');
+            throw std::runtime_error("syntax error in theory file:" + pth + " line " +
+                                     std::to_string(line) + ", expected " + expected);
         }
 
-        // initialize theory data
-        std::vector<SortDecl> sorts;
-        std::vector<OpDecl> ops;
-        std::vector<Rule> rules;
+        void space()
+        {
+            while (pos != src.size() && std::string_view(" \t\r\n,").find(src[pos]) != std::string_view::npos)
+                pos++;
+        }
 
-        // Parse the top-level theory data
-        for (int i = 1; i < ast->nodes.size(); i++)
+        // Whether the next token starts with lit
+        bool at(const std::string_view &lit)
         {
-            std::shared_ptr<peg::Ast> item = ast->nodes.at(i);
-            if (item->name == "SortDecl")
-                sorts.push_back(parseSort(item, kinddict));
-            else if (item->name == "OpDecl")
-                ops.push_back(parseOp(item, kinddict));
-            else if (item->name == "Rule")
-                rules.push_back(parseRule(item, kinddict));
-            else
-            {
-                throw std::runtime_error("Bad theory file: " + pth + " has top-level " + (item->name));
-            }
+            space();
+            return src.substr(pos, lit.size()) == lit;
         }
-        return {name, sorts, ops, rules};
-    }
-    else
-    {
-        throw std::runtime_error("syntax error in theory file:" + pth);
-    }
-}
 
-Expr Theory::parseExpr(std::shared_ptr<peg::Ast> ast, KindDict kd)
-{
-    std::string name;
-    Expr::NodeType nt;
-    Ve args;
+        void expect(const std::string_view &lit)
+        {
+            if (!at(lit))
+                fail("'" + std::string(lit) + "'");
+            pos += lit.size();
+        }
 
-    // Handle a term with a manual type annotation specially
-    if (ast->choice == 3) {
-        assert(ast->nodes.size()==2);
-        Expr trm = parseExpr(ast->nodes.at(0), kd);
-        Expr typ = parseExpr(ast->nodes.at(1), kd);
-        Ve newargs={typ};
-        for (auto &&e : trm.args)
-            newargs.push_back(e);
-        return {trm.sym, trm.kind, newargs};
-    }
+        static bool wordchar(const char &c, const bool &first)
+        {
+            return c == '_' || (first ? std::isalpha((unsigned char)c) : std::isalnum((unsigned char)c));
+        }
 
+        std::string_view word()
+        {
+            space();
+            size_t start = pos;
+            while (pos != src.size() && wordchar(src[pos], pos == start))
+                pos++;
+            if (pos == start)
+                fail("a symbol");
+            return src.substr(start, pos - start);
+        }
 
+        // Consume the next word if it is k
+        bool keyword(const std::string_view &k)
+        {
+            size_t start = pos;
+            if (at(k) && word() == k)
+                return true;
+            pos = start;
+            return false;
+        }
 
-    if (ast->nodes.empty())
-        name = ast->token; // no argument case
-    else
-    {
-        // First arg is the symbol, others should be recursively parsed
-        for (int i = 0; i != ast->nodes.size(); i++)
+        std::string phrase()
         {
-            if (i == 0)
-                name = ast->nodes.at(i)->token;
-            else
-                args.push_back(parseExpr(ast->nodes.at(i), kd));
+            expect("\"");
+            size_t end = src.find('"', pos);
+            if (end == std::string_view::npos)
+                fail("'\"'");
+            std::string res(src.substr(pos, end - pos));
+            pos = end + 1;
+            return res;
         }
-    }
 
-    // Assume unknown symbols are variables
-    if (kd.find(name) == kd.end())
-        nt = Expr::VarNode;
-    else if (kd.at(name) == Expr::AppNode)
-        nt = Expr::AppNode;
-    else
-        nt = Expr::SortNode;
+        // A term (nothing in the first pass)
+        std::optional<Expr> term()
+        {
+            // Term with a manual type annotation, which becomes its first arg
+            if (at("[["))
+            {
+                pos += 2;
+                std::optional<Expr> trm = term();
+                expect("|");
+                std::optional<Expr> typ = term();
+                expect("]]");
+                if (declaring)
+                    return std::nullopt;
+                Ve args{*typ};
+                for (auto &&e : trm->args)
+                    args.push_back(e);
+                return Expr(trm->sym, trm->kind, args);
+            }
 
-    Expr out{name, nt, args}; // validate_expr
+            std::string_view w = word();
+            Ve args;
+            if (at(":"))
+            {
+                pos++;
+                std::optional<Expr> srt = term();
+                if (!declaring)
+                    args.push_back(*srt);
+            }
+            else if (at("("))
+            {
+                pos++;
+                while (!at(")"))
+                {
+                    std::optional<Expr> arg = term();
+                    if (!declaring)
+                        args.push_back(*arg);
+                }
+                pos++;
+            }
+            if (declaring)
+                return std::nullopt;
 
-    return out;
-}
+            // Assume unknown symbols are variables
+            Sym s{std::string(w)};
+            auto it = kinds.find(s);
+            return Expr(s, it == kinds.end() ? Expr::VarNode : it->second, args);
+        }
 
-SortDecl Theory::parseSort(std::shared_ptr<peg::Ast> ast, KindDict kd)
-{
-    Ve args;
-    for (int i = 3; i != ast->nodes.size(); i++)
-        args.push_back(parseExpr(ast->nodes.at(i), kd));
+        Ve terms(const std::string_view &close)
+        {
+            Ve res;
+            while (!at(close))
+            {
+                std::optional<Expr> x = term();
+                if (!declaring)
+                    res.push_back(*x);
+            }
+            pos += close.size();
+            return res;
+        }
 
-    return {ast->nodes.at(0)->token,
-            trim(ast->nodes.at(1)->token),
-            args, trim(ast->nodes.at(2)->token)};
+        void read()
+        {
+            pos = 0;
+            name = word();
+            for (space(); pos != src.size(); space())
+            {
+                if (keyword("Sort"))
+                {
+                    Sym s{std::string(word())};
+                    std::string pat = phrase(), desc = phrase();
+                    expect("[");
+                    Ve args = terms("]");
+                    if (declaring)
+                        kinds.insert({s, Expr::SortNode});
+                    else
+                        sorts.push_back({s, pat, args, desc});
+                }
+                else if (keyword("Op"))
+                {
+                    Sym s{std::string(word())};
+                    std::string pat = phrase(), desc = phrase();
+                    std::optional<Expr> srt = term();
+                    expect("[");
+                    Ve args = terms("]");
+                    if (declaring)
+                        kinds.insert({s, Expr::AppNode});
+                    else
+                        ops.push_back({s, pat, *srt, args, desc});
+                }
+                else if (keyword("Rule"))
+                {
+                    std::string rname(word());
+                    std::string desc = phrase();
+                    std::optional<Expr> t1 = term(), t2 = term();
+                    if (!declaring)
+                        rules.push_back({rname, desc, *t1, *t2});
+                }
+                else
+                    fail("Sort, Op or Rule");
+            }
+        }
+    };
 }
 
-OpDecl Theory::parseOp(std::shared_ptr<peg::Ast> ast, KindDict kd)
-{
-    Ve args;
-    for (int i = 4; i != ast->nodes.size(); i++)
-        args.push_back(parseExpr(ast->nodes.at(i), kd));
-    return {ast->nodes.at(0)->token,
-            trim(ast->nodes.at(1)->token),
-            parseExpr(ast->nodes.at(3), kd),
-            args, trim(ast->nodes.at(2)->token)};
-}
-Rule Theory::parseRule(std::shared_ptr<peg::Ast> ast, KindDict kd)
+Theory Theory::parseTheory(const std::string pth)
 {
-    return {ast->nodes.at(0)->token,
-            trim(ast->nodes.at(1)->token),
-            parseExpr(ast->nodes.at(2), kd),
-            parseExpr(ast->nodes.at(3), kd)};
+    // Validate path to file containing the GAT
+    std::ifstream infile(pth, std::ios::binary);
+    if (infile.fail())
+    {
+        infile.close();
+        throw std::runtime_error("Bad path to theory file: " + pth);
+    }
+    std::string content((std::istreambuf_iterator<char>(infile)),
+                        (std::istreambuf_iterator<char>()));
+
+    TheoryReader reader{pth, content};
+    reader.read();
+    reader.declaring = false;
+    reader.read();
+    return {reader.name, reader.sorts, reader.ops, reader.rules};
 }
 
 void Theory::validate_theory()
@@ -433,59 +773,73 @@ std::string join(const std::vector<T> &v, const std::string &sep)
     return s;
 }
 
+template std::string join(const std::vector<int> &v, const std::string &sep);
+template std::string join(const std::vector<std::string> &v, const std::string &sep);
+
 std::string trim(const std::string &x)
 {
     return x.substr(1, x.length() - 2);
 }
 
-std::map<Vi, size_t> Expr::gethash() const
+Positions Expr::positions() const
 {
-    // Build up result mapping recursively
-    std::map<Vi, size_t> result;
-
-    Vi arghashes; // Hashes of one's immediate arguments
-    for (int i = 0; i != args.size(); i++)
+    Positions res;
+    // Explicit stack of positions to visit, popped in preorder
+    std::vector<std::pair<int, int>> todo{{-1, -1}};
+    std::vector<const Expr *> todox{this};
+    while (!todo.empty())
     {
-        for (auto &&[subpath, sp_hash] : args[i].gethash())
+        auto [par, i] = todo.back();
+        const Expr *x = todox.back();
+        todo.pop_back();
+        todox.pop_back();
+
+        int curr = res.terms.size();
+        res.terms.push_back(*x);
+        res.parent.push_back(par);
+        res.argi.push_back(i);
+
+        // Push args in reverse so the first arg is visited next
+        for (size_t j = x->args.size(); j--;)
         {
-            if (subpath.empty())
-                arghashes.push_back(sp_hash);
-            Vi newk = subpath;
-            newk.insert(newk.begin(), i);
-            result[newk] = sp_hash;
+            todo.push_back({curr, j});
+            todox.push_back(&x->args[j]);
         }
     }
-    // Create hash by hashing the argument hashes
-    size_t curr = std::hash<std::string>()(sym + join(arghashes, "|"));
+    return res;
+}
 
-    result[Vi()] = curr; // Append to the result
+size_t Positions::size() const
+{
+    return terms.size();
+}
 
-    return result;
+Vi Positions::path(const int &i) const
+{
+    Vi res;
+    for (int j = i; parent.at(j) >= 0; j = parent.at(j))
+        res.push_back(argi.at(j));
+    std::reverse(res.begin(), res.end());
+    return res;
 }
 
-std::map<size_t, Vvi> Expr::distinct(const std::map<Vi, size_t> &hashes)
+std::map<Hash128, Vvi> Expr::distinct(const Positions &pos)
 {
-    std::map<size_t, Vvi> result;
-    for (auto &&[subpath, hashval] : hashes)
-    {
-        if (result.find(hashval) == result.end())
-            result[hashval] = {subpath}; // first time seeing this term
-        else
-            result[hashval].push_back(subpath);
-    }
+    std::map<Hash128, Vvi> result;
+    for (size_t i = 0; i != pos.size(); i++)
+        result[pos.terms[i].hash()].push_back(pos.path(i));
     return result;
 }
 
 Expr Expr::subexpr(const Vi &pth) const
 {
-    const Expr copy = Expr(*this);
-    std::vector<Expr> res{copy}; // initial condition
-    for (auto i : pth)           // keep taking the i'th argument, building up a list of terms
-        res.emplace_back(res.back().args.at(i));
-    return res.back(); // The final term of this list is the one we want
+    const Expr *res = this; // Exprs are handles, so no copying until the end
+    for (auto i : pth)      // keep taking the i'th argument
+        res = &res->args.at(i);
+    return *res;
 }
 
-void Expr::addx(std::set<std::string> &syms, const int &node_type) const
+void Expr::addx(std::set<Sym> &syms, const int &node_type) const
 {
     if (node_type < 0 || kind == node_type)
         syms.insert(sym);
@@ -494,10 +848,10 @@ void Expr::addx(std::set<std::string> &syms, const int &node_type) const
 }
 
 // Encode each symbol mentioned in a theory as a unique integer
-std::map<std::string, int> Theory::symcode() const
+std::shared_ptr<const Theory::SymCode> Theory::mk_symcode() const
 {
     // Grab all the symbols mentioned anywhere
-    std::set<std::string> syms;
+    std::set<Sym> syms;
     for (auto &&[_, v] : sorts)
     {
         for (auto &&e : v.args)
@@ -514,14 +868,95 @@ std::map<std::string, int> Theory::symcode() const
         r.t1.addx(syms);
         r.t2.addx(syms);
     }
-    // Give each a unique number starting at 1
-    std::map<std::string, int> result;
-    int i = 1;
-    for (auto str : syms)
-        result[str] = i++;
+    // Give each a unique number starting at 1 (in alphabetical order)
+    std::vector<Sym> names(syms.begin(), syms.end());
+    std::sort(names.begin(), names.end(), [](const Sym &a, const Sym &b) { return a.str() < b.str(); });
+
+    auto result = std::make_shared<SymCode>();
+    result->bycode.push_back(Sym());
+    for (auto &&sym : names)
+    {
+        int i = result->bycode.size();
+        result->bystring[sym.str()] = i;
+        if (sym.id() >= result->byid.size())
+            result->byid.resize(sym.id() + 1, 0);
+        result->byid[sym.id()] = i;
+        result->bycode.push_back(sym);
+    }
+    return result;
+}
+
+std::shared_ptr<const std::vector<Pattern>> Theory::mk_programs() const
+{
+    auto result = std::make_shared<std::vector<Pattern>>();
+    for (int i = 1; i <= rules.size(); i++)
+    {
+        result->push_back(Pattern::compile(*this, i, true));
+        result->push_back(Pattern::compile(*this, i, false));
+    }
     return result;
 }
 
+const Pattern &Theory::program(const int &rule, const bool &forward) const
+{
+    return programs->at(2 * (rule - 1) + (forward ? 0 : 1));
+}
+
+const RuleIndex &Theory::rule_index() const
+{
+    return *ruleindex;
+}
+
+const std::map<std::string, int> &Theory::symcode() const
+{
+    return codes->bystring;
+}
+
+int Theory::code(const Sym &s) const
+{
+    return s.id() < codes->byid.size() ? codes->byid[s.id()] : 0;
+}
+
+Sym Theory::decode(const int &c) const
+{
+    return (c > 0 && c < codes->bycode.size()) ? codes->bycode[c] : Sym();
+}
+
+Hash128 Theory::hash() const
+{
+    Hasher h;
+    auto add = [&](const Expr &e) {
+        h.add(e.hash().hi);
+        h.add(e.hash().lo);
+    };
+    // Alphabetical, since the order of Sym ids depends on parsing order
+    for (auto &&k : sorted_syms(sorts))
+    {
+        const SortDecl &v = sorts.at(k);
+        h.add(k.str());
+        h.add(v.pat);
+        h.add(v.args.size());
+        for (auto &&a : v.args)
+            add(a);
+    }
+    for (auto &&k : sorted_syms(ops))
+    {
+        const OpDecl &v = ops.at(k);
+        h.add(k.str());
+        h.add(v.pat);
+        add(v.sort);
+        h.add(v.args.size());
+        for (auto &&a : v.args)
+            add(a);
+    }
+    for (auto &&r : rules)
+    {
+        add(r.t1);
+        add(r.t2);
+    }
+    return {h.a, h.b};
+}
+
 // If failure, return dict with "" key.
 void Expr::mergedict(MatchDict &acc, const MatchDict &m)
 {
@@ -531,7 +966,7 @@ void Expr::mergedict(MatchDict &acc, const MatchDict &m)
             acc.insert({k, v}); // NEW KEY
         else if (acc.at(k) != v)
         {
-            acc.insert({"", v}); // CONFLICT
+            acc.insert({Sym(), v}); // CONFLICT
         }
     }
 }
@@ -555,7 +990,7 @@ MatchDict Expr::patmatch(const Expr &expr) const
         return result;
     }
     else if (expr.sym != sym || expr.args.size() != args.size())
-        return {{"", expr}}; // error match result
+        return {{Sym(), expr}}; // error match result
     else
     {
         // Recurse on arguments if top-level constant symbol agrees
@@ -593,13 +1028,15 @@ bool Expr::inferred() const
 
 Expr Expr::infer(const SortDeclDict &sorts,
                  const OpDeclDict &ops,
-                 const std::string &sym,
-                 const Ve &args)
+                 const Sym &sym,
+                 const Ve &args,
+                 UpgradeMemo *memo)
 {
 
     // Handle error of unknown operator
-    if (ops.find(sym) == ops.end())
-        throw std::runtime_error("inferring a symbol (" + sym + ")not in ops");
+    auto op = ops.find(sym);
+    if (op == ops.end())
+        throw std::runtime_error("inferring a symbol (" + sym.str() + ")not in ops");
 
     // Handle operators mistakenly operating on sorts
     for (auto &&a : args)
@@ -608,7 +1045,7 @@ Expr Expr::infer(const SortDeclDict &sorts,
             throw std::runtime_error("inferring a term that has a Sort as a direct argument: is this term already inferred?");
     }
 
-    Ve op_pat_args = ops.at(sym).args;
+    const Ve &op_pat_args = op->second.args;
 
     // Handle error of incorrect # of args
     if (op_pat_args.size() != args.size())
@@ -628,7 +1065,7 @@ Expr Expr::infer(const SortDeclDict &sorts,
     {
         Expr x = args.at(i), pat = op_pat_args.at(i);
         MatchDict newmatch = pat.patmatch(x);
-        if (newmatch.find("") != newmatch.end())
+        if (newmatch.find(Sym()) != newmatch.end())
         {
             std::stringstream buf;
             buf << sym << " pattern match fail for inferring arg " << i << std::endl;
@@ -638,7 +1075,7 @@ Expr Expr::infer(const SortDeclDict &sorts,
         }
         mergedict(match, newmatch);
 
-        if (match.find("") != match.end())
+        if (match.find(Sym()) != match.end())
         {
             std::stringstream buf;
             buf << sym << " pattern match fail given conflicting args after adding arg " << i << std::endl;
@@ -648,66 +1085,84 @@ Expr Expr::infer(const SortDeclDict &sorts,
         }
     }
     // Result sort is just a substitution of the canonical result sort
-    Expr res=ops.at(sym).sort.sub(match);
+    Expr res=op->second.sort.sub(match);
      //upgrade because the op return type pattern may contain a function which needs its
      // type to be inferred
-    return res.upgrade(sorts, ops);
+    return res.upgrade(sorts, ops, memo);
 }
 
 // Elaborate type information by recursively calling infer
 Expr Expr::upgrade(const SortDeclDict &sorts,
-                   const OpDeclDict &ops) const
+                   const OpDeclDict &ops,
+                   UpgradeMemo *memo) const
 {
+    // Equal subterms are the same node, so each is elaborated once
+    if (memo)
+    {
+        auto it = memo->find(id());
+        if (it != memo->end())
+            return it->second;
+    }
+
+    Ve newargs;
     // Avoid upgrading something that has already been upgraded
     if (this->kind==AppNode && !this->args.empty() && this->args.at(0).kind ==SortNode) {
-        Ve recargs = {this->args.at(0)};
+        newargs.push_back(this->args.at(0));
         for (int i = 1; i != args.size(); i++)
-            {recargs.push_back(this->args.at(i).upgrade(sorts, ops));}
-        return {this->sym, this->kind, recargs};
+            {newargs.push_back(this->args.at(i).upgrade(sorts, ops, memo));}
+    }
+    else
+    {
+        Ve recargs;
+        for (auto &&a : args)
+            recargs.push_back(a.upgrade(sorts, ops, memo));
+        if (kind == Expr::AppNode)
+            {newargs.push_back(infer(sorts, ops, sym, recargs, memo));}
+        for (auto &&a : recargs)
+            newargs.push_back(a);
     }
-    Ve recargs, newargs;
-    for (auto &&a : args)
-        recargs.push_back(a.upgrade(sorts, ops));
-    if (kind == Expr::AppNode)
-        {newargs.push_back(infer(sorts, ops, sym, recargs));}
-    for (auto &&a : recargs)
-        newargs.push_back(a);
 
     Expr res{sym, kind, newargs};
+    if (memo)
+        memo->emplace(id(), res);
     return res;
 }
 
 // Elaborate type information
 Expr Theory::upgrade(const Expr &e) const
 {
-    return e.upgrade(sorts, ops);
+    UpgradeMemo memo;
+    return e.upgrade(sorts, ops, &memo);
 }
 
 // Elaborate type information
 SortDecl SortDecl::upgrade(const SortDeclDict &sorts,
-                           const OpDeclDict &ops) const
+                           const OpDeclDict &ops,
+                           UpgradeMemo *memo) const
 {
     Ve newargs;
     for (auto &&a : args)
-        newargs.push_back(a.upgrade(sorts, ops));
+        newargs.push_back(a.upgrade(sorts, ops, memo));
     return {sym, pat, newargs, desc};
 }
 
 // Elaborate type information
 OpDecl OpDecl::upgrade(const SortDeclDict &sorts,
-                       const OpDeclDict &ops) const
+                       const OpDeclDict &ops,
+                       UpgradeMemo *memo) const
 {
     Ve newargs;
     for (auto &&a : args)
-        newargs.push_back(a.upgrade(sorts, ops));
-    return {sym, pat, sort.upgrade(sorts, ops), newargs, desc};
+        newargs.push_back(a.upgrade(sorts, ops, memo));
+    return {sym, pat, sort.upgrade(sorts, ops, memo), newargs, desc};
 }
 
 // Elaborate type information
 Rule Rule::upgrade(const SortDeclDict &sorts,
-                   const OpDeclDict &ops) const
+                   const OpDeclDict &ops,
+                   UpgradeMemo *memo) const
 {
-    return {name, desc, t1.upgrade(sorts, ops), t2.upgrade(sorts, ops)};
+    return {name, desc, t1.upgrade(sorts, ops, memo), t2.upgrade(sorts, ops, memo)};
 }
 
 // Elaborate type information
@@ -716,22 +1171,23 @@ Theory Theory::upgrade() const
     SortDeclDict newsorts;
     OpDeclDict newops;
     std::vector<Rule> newrules;
-    // TODO: In general, we should topologically sort the sorts and operations
+    // Everything is elaborated against the declarations as written, so their
+    // order does not matter. They mention the same sorts (e.g. Hom(A:Ob,B:Ob))
+    // over and over, so they share one memo and each is elaborated once.
+    UpgradeMemo memo;
     for (auto &&[k, v] : sorts)
     {
-        newsorts.insert(std::pair<std::string, SortDecl>(k, v.upgrade(sorts, ops)));
+        newsorts.insert(std::pair<Sym, SortDecl>(k, v.upgrade(sorts, ops, &memo)));
     }
     for (auto &&[k, v] : ops)
     {
-        newops.insert(std::pair<std::string, OpDecl>(k, v.upgrade(sorts, ops)));
+        newops.insert(std::pair<Sym, OpDecl>(k, v.upgrade(sorts, ops, &memo)));
     }
     for (auto &&r : rules)
     {
-        newrules.push_back(r.upgrade(sorts, ops));
+        newrules.push_back(r.upgrade(sorts, ops, &memo));
     }
-    Theory *t2 = new Theory(name, newsorts, newops, newrules);
-    // t2.validate_sorted_theory();
-    return *t2;
+    return Theory(name, newsorts, newops, newrules);
 }
 
 int Theory::max_arity() const
@@ -791,27 +1247,39 @@ std::string Theory::strParser(const std::string &pat)
     return ss.str();
 }
 
+template <typename T>
+std::vector<Sym> Theory::sorted_syms(const std::map<Sym, T> &dict)
+{
+    std::vector<Sym> res;
+    for (auto &&[k, v] : dict)
+        res.push_back(k);
+    std::sort(res.begin(), res.end(), [](const Sym &a, const Sym &b) { return a.str() < b.str(); });
+    return res;
+}
+
 std::string Theory::mkParser() const
 {
+    // Alternatives are listed alphabetically so the grammar does not depend on interning order
+    std::vector<Sym> sortsyms = sorted_syms(sorts), opsyms = sorted_syms(ops);
     std::stringstream ss;
     ss << "Term <- Var";
-    for (auto &&[k, v] : ops)
+    for (auto &&k : opsyms)
         ss << " / " << k;
     ss << "\nSort <- ";
     int i = 0;
-    for (auto &&p : sorts)
+    for (auto &&k : sortsyms)
     {
         if (i != 0)
             ss << " / ";
-        ss << p.first;
+        ss << k;
         i++;
     }
     ss << '\n';
-    for (auto &&[k, v] : sorts)
-        ss << k << " <-  " << strParser(v.pat);
+    for (auto &&k : sortsyms)
+        ss << k << " <-  " << strParser(sorts.at(k).pat);
     ss << "\n";
-    for (auto &&[k, v] : ops)
-        ss << k << " <-  " << strParser(v.pat);
+    for (auto &&k : opsyms)
+        ss << k << " <-  " << strParser(ops.at(k).pat);
     ss << "Var <- WORD ':' Sort\nWORD <- < [a-zA-Z] [a-zA-Z0-9]* >\n%whitespace  <-  [ \\t\\r\\n]*";
     return ss.str();
 }
@@ -832,14 +1300,21 @@ Ve Theory::parse_exprs(const std::string &pth) const
     return res;
 }
 
-Expr Theory::parse_expr(const std::string &expr) const
+// Compile the expression grammar the first time it is needed
+const peg::parser &Theory::term_parser() const
 {
-    peg::parser parser(mkParser().c_str());
-    parser.enable_ast();
-    assert((bool)parser == true);
+    std::call_once(termparser->compiled, [this] {
+        termparser->parser = std::make_unique<peg::parser>(mkParser().c_str());
+        assert((bool)*termparser->parser == true);
+        termparser->parser->enable_ast();
+    });
+    return *termparser->parser;
+}
 
+Expr Theory::parse_expr(const std::string &expr) const
+{
     std::shared_ptr<peg::Ast> ast;
-    if (parser.parse(expr.c_str(), ast))
+    if (term_parser().parse(expr.c_str(), ast))
     {
         return ast_to_expr(ast);
     }
@@ -851,7 +1326,6 @@ Expr Theory::parse_expr(const std::string &expr) const
 
 Expr Theory::ast_to_expr(const std::shared_ptr<peg::Ast> &ast) const
 {
-    Expr res{"x", Expr::AppNode, {}};
     std::string kind = ast->name;
 
     if ((kind != "Term" && kind != "Sort") || ast->nodes.size() != 1)
@@ -886,14 +1360,13 @@ Expr Theory::ast_to_expr(const std::shared_ptr<peg::Ast> &ast) const
     }
 }
 
-std::map<std::string, int> Expr::freevar(const Expr &y) const
+std::map<Sym, int> Expr::freevar(const Expr &y) const
 {
-    std::set<std::string> symx, symy;
-    Expr copy = Expr(*this);
-    copy.addx(symx, Expr::VarNode);
+    std::set<Sym> symx, symy;
+    addx(symx, Expr::VarNode);
     y.addx(symy, Expr::VarNode);
 
-    std::map<std::string, int> res;
+    std::map<Sym, int> res;
     int i = 1;
     for (auto &&e : symx)
     {
@@ -9,22 +9,106 @@
 #include <string>
 #include <set>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
 
 #include "../external/peglib.h"
 
 // Forward declarations
 struct Expr;
+struct ExprNode;
+struct Positions;
 struct OpDecl;
 struct SortDecl;
+struct Pattern;
+struct RuleIndex;
+
+/**
+ * 128-bit structural hash. It depends only on the symbol strings, kinds and
+ * shape of a term, so it is stable across runs (unlike node/symbol ids).
+ */
+struct Hash128
+{
+public:
+    uint64_t hi;
+    uint64_t lo;
+
+    bool operator==(const Hash128 &that) const;
+    bool operator!=(const Hash128 &that) const;
+    bool operator<(const Hash128 &that) const;
+
+    // 32 hex digits
+    std::string hex() const;
+
+    /**
+     * Hash of a byte string, e.g. the contents of a file
+     */
+    static Hash128 of(const std::string &bytes);
+};
+
+/**
+ * Interned symbol (sort, operator or variable name)
+ * Every distinct string is assigned a small integer once, so comparing,
+ * hashing and ordering symbols never touches the characters.
+ * The empty string is always symbol 0.
+ */
+struct Sym
+{
+public:
+    Sym();
+    Sym(const std::string &s);
+    Sym(const char *s);
+
+    // Small integer identifying the symbol
+    int id() const;
+    // The interned string
+    const std::string &str() const;
+    bool empty() const;
+
+    bool operator==(const Sym &that) const;
+    bool operator!=(const Sym &that) const;
+    // Orders by id (i.e. order of first interning), not alphabetically
+    bool operator<(const Sym &that) const;
+
+    friend std::ostream &operator<<(std::ostream &out, const Sym &s);
+
+    /**
+     * @returns Number of symbols interned so far (ids are 0 ... n-1)
+     */
+    static int count();
+
+    /**
+     * Inverse of id()
+     * @returns The symbol with id i, or the empty symbol if there is none
+     */
+    static Sym byid(const int &i);
+
+private:
+    int i;
+    const std::string *name;
+};
+
+namespace std
+{
+    template <>
+    struct hash<Sym>
+    {
+        size_t operator()(const Sym &s) const { return s.id(); }
+    };
+}
 
 // Abbreviations
 typedef std::vector<int> Vi;
 typedef std::vector<Vi> Vvi;
 typedef std::vector<std::string> Vs;
 typedef std::vector<Expr> Ve;
-typedef std::map<std::string, Expr> MatchDict;
-typedef std::map<std::string, SortDecl> SortDeclDict;
-typedef std::map<std::string, OpDecl> OpDeclDict;
+typedef std::map<Sym, Expr> MatchDict;
+typedef std::map<Sym, SortDecl> SortDeclDict;
+typedef std::map<Sym, OpDecl> OpDeclDict;
+// Upgraded form of each distinct Expr (by id), see Expr::upgrade
+typedef std::unordered_map<size_t, Expr> UpgradeMemo;
 
 /**
  * Term in a theory
@@ -41,29 +125,47 @@ public:
         SortNode
     } NodeType;
 
+private:
+    // Hash-consed node shared by every structurally equal Expr
+    const ExprNode *node;
+
+public:
     // Symbol of top-level node
-    const std::string sym;
+    const Sym &sym;
 
     // Nodetype of top-level node
-    const NodeType kind;
+    const NodeType &kind;
 
     // Arguments of an AppNode, i.e. term level operator (like + 1 1)
     // or for a SortNode, e.g. Hom(A:Ob, B:Ob)
-    const std::vector<Expr> args;
+    const std::vector<Expr> &args;
 
     // Safe constructor
-    Expr(const std::string s, const NodeType k, const std::vector<Expr> a);
+    Expr(const Sym s, const NodeType k, const std::vector<Expr> a);
+
+    /**
+     * Unique index of the interned node: structurally equal Exprs share it
+     */
+    size_t id() const;
 
     /**
      * Elaborate type information
+     * @param memo Upgraded subterms, filled in and reused (only valid for
+     *             the same sorts and ops)
      */
     Expr upgrade(const SortDeclDict &sorts,
-                 const OpDeclDict &ops) const;
+                 const OpDeclDict &ops,
+                 UpgradeMemo *memo = nullptr) const;
+
+    /**
+     * Structural hash, computed once when the node is interned
+     */
+    const Hash128 &hash() const;
 
     /**
-     * Compute hash of every element indexed by its subpath
+     * Enumerate every subterm with its position (in preorder)
      */
-    std::map<Vi, size_t> gethash() const;
+    Positions positions() const;
 
     /**
      * Substitute any variables in match dictionary into Expr
@@ -83,6 +185,7 @@ public:
      */
     Expr subexpr(const Vi &pth) const;
 
+    // O(1): equal Exprs are the same interned node
     bool operator==(const Expr &that) const;
 
     bool operator!=(Expr const &that) const;
@@ -95,10 +198,11 @@ public:
 
     /**
      * Group all subterms by hash
-     * @param hashes Mapping of subpaths to their hashes, assumed to be the result of calling gethash()
+     * @param pos Subterm positions, assumed to be the result of calling positions()
      * @returns a mapping from hashes to a list of subpaths that share the same value
+     *          (each list is in preorder, so the first path is the shallowest/leftmost)
      */
-    static std::map<size_t, Vvi> distinct(const std::map<Vi, size_t> &hashes);
+    static std::map<Hash128, Vvi> distinct(const Positions &pos);
 
 
     /*
@@ -112,12 +216,14 @@ public:
      * @param ops OpDecls of a theory
      * @param sym operator symbol being applied
      * @param args args to which operator is applied
+     * @param memo Upgraded subterms (see upgrade)
      * @returns a SortNode expr, according to the theory being used
      */
     static Expr infer(const SortDeclDict &sorts,
                       const OpDeclDict &ops,
-                      const std::string &sym,
-                      const Ve &args);
+                      const Sym &sym,
+                      const Ve &args,
+                      UpgradeMemo *memo = nullptr);
 
     /**
      * Combine two dictionaries
@@ -126,7 +232,7 @@ public:
 
     /**
      * Match a pattern expression (*this*) with an argument expr
-     * If failure, return dict with "" key.
+     * If failure, return dict with "" (i.e. Sym 0) key.
      * @param x Expression to which pattern (this) is matched
      * @returns a mapping from the variables in *this* to substerms in x, if possible
      */
@@ -138,20 +244,73 @@ public:
      * @param y Background term with variables which should be considered as bound
      * @returns Numbered variables that do not appear in y
      */
-    std::map<std::string, int> freevar(const Expr &y) const;
+    std::map<Sym, int> freevar(const Expr &y) const;
 
     /**
      * Collect all symbols in the expr, (impure function modifies its arg)
      * @param syms Set of symbols to be added to
      * @param nodetype Optional filter to only add symbols from a particular NodeType (-1 means no filter)
      */
-    void addx(std::set<std::string> &syms, const int &nodetype = -1) const;
+    void addx(std::set<Sym> &syms, const int &nodetype = -1) const;
 
 private:
-    void validate_expr();
+    static void validate_expr(const Sym &s, const NodeType &k, const Ve &a);
+
+    /**
+     * Find (or create) the unique node with this symbol, kind and arguments
+     */
+    static const ExprNode *intern(const Sym &s, const NodeType &k, const Ve &a);
+};
+
+/**
+ * Node of the hash-consed term store. Every distinct (sym, kind, args) is
+ * allocated exactly once and never freed, so an Expr is just a handle to one.
+ */
+struct ExprNode
+{
+public:
+    const Sym sym;
+    const Expr::NodeType kind;
+    const std::vector<Expr> args;
+    // Order in which nodes were interned
+    const size_t id;
+    // Structural hash of the whole subterm
+    const Hash128 hash;
+};
+
+/**
+ * All subterm positions of an Expr in preorder. Rather than storing a full
+ * path per position, each position records its parent position and which
+ * argument of the parent it is, so paths share their prefixes.
+ */
+struct Positions
+{
+public:
+    // Subterm found at each position (position 0 is the root)
+    Ve terms;
+    // Index of the parent position (-1 for the root)
+    Vi parent;
+    // Which argument of the parent this position is
+    Vi argi;
+
+    size_t size() const;
+
+    /**
+     * Materialize the path of argument indices leading to a position
+     */
+    Vi path(const int &i) const;
 };
 
-typedef std::map<std::string, Expr::NodeType> KindDict;
+namespace std
+{
+    template <>
+    struct hash<Expr>
+    {
+        size_t operator()(const Expr &e) const { return e.id(); }
+    };
+}
+
+typedef std::map<Sym, Expr::NodeType> KindDict;
 
 /**
  * Specification of a sort within a theory
@@ -159,8 +318,8 @@ typedef std::map<std::string, Expr::NodeType> KindDict;
 struct SortDecl
 {
 public:
-    // Unique string of the sort, e.g. Int/Ob/Hom
-    const std::string sym;
+    // Unique symbol of the sort, e.g. Int/Ob/Hom
+    const Sym sym;
     // How terms with this sort should be printed and parsed, e.g. "({}⇒{})"
     const std::string pat;
     // Canonical arguments, e.g. [A:Ob,B:Ob] for defining 'Hom' as Hom(A,B)
@@ -175,7 +334,8 @@ public:
      * Elaborate type information
      */
     SortDecl upgrade(const SortDeclDict &sorts,
-                     const OpDeclDict &ops) const;
+                     const OpDeclDict &ops,
+                     UpgradeMemo *memo = nullptr) const;
 };
 
 /**
@@ -184,8 +344,8 @@ public:
 struct OpDecl
 {
 public:
-    // Unique string of the sort, e.g. Plus
-    const std::string sym;
+    // Unique symbol of the operator, e.g. Plus
+    const Sym sym;
     // How terms with this sort should be printed and parsed, e.g. "({}+{})"
     const std::string pat;
     // The result sort of applying the function to the canonical arguments,
@@ -203,7 +363,8 @@ public:
      * Elaborate type information
      */
     OpDecl upgrade(const SortDeclDict &sorts,
-                   const OpDeclDict &ops) const;
+                   const OpDeclDict &ops,
+                   UpgradeMemo *memo = nullptr) const;
 };
 
 /**
@@ -221,7 +382,8 @@ public:
      *  Elaborate type information
      */
     Rule upgrade(const SortDeclDict &sorts,
-                 const OpDeclDict &ops) const;
+                 const OpDeclDict &ops,
+                 UpgradeMemo *memo = nullptr) const;
 
     bool operator==(const Rule &that) const;
     bool operator!=(const Rule &that) const;
@@ -293,9 +455,77 @@ public:
     Expr parse_expr(const std::string &expr) const;
     static Theory parseTheory(const std::string pth);
 
-    std::map<std::string, int> symcode() const;
+    /**
+     * Encoding of each symbol mentioned in the theory as a unique integer
+     * (numbered from 1 in alphabetical order), computed once on construction
+     */
+    const std::map<std::string, int> &symcode() const;
+
+    /**
+     * @returns The integer encoding of a symbol, or 0 if the theory does not mention it
+     */
+    int code(const Sym &s) const;
+
+    /**
+     * Inverse of code()
+     * @returns The symbol encoded by c, or the empty Sym if none is
+     */
+    Sym decode(const int &c) const;
+
+    /**
+     * Content hash of the sorts, operators and rules (but not the names or
+     * descriptions), i.e. of everything the SMT encoding depends on
+     */
+    Hash128 hash() const;
+
+    /**
+     * Compiled program of one direction of a rule (see pattern.hpp),
+     * computed once on construction
+     * @param rule 1-indexed rule
+     * @param forward Whether t1 is rewritten to t2 or t2 to t1
+     */
+    const Pattern &program(const int &rule, const bool &forward) const;
+
+    /**
+     * Discrimination tree of the rules (see ruleindex.hpp), built once on
+     * construction
+     */
+    const RuleIndex &rule_index() const;
 
 private:
+    // Forward and reverse tables for symcode()/code()/decode()
+    struct SymCode
+    {
+        std::map<std::string, int> bystring;
+        // Indexed by Sym::id(), 0 for symbols not in the theory
+        Vi byid;
+        // Indexed by code, entry 0 is unused
+        std::vector<Sym> bycode;
+    };
+    std::shared_ptr<const SymCode> codes;
+
+    std::shared_ptr<const SymCode> mk_symcode() const;
+
+    // Indexed by 2*(rule-1) + (forward ? 0 : 1)
+    std::shared_ptr<const std::vector<Pattern>> programs;
+
+    std::shared_ptr<const std::vector<Pattern>> mk_programs() const;
+
+    std::shared_ptr<const RuleIndex> ruleindex;
+
+    /**
+     * Expression parser generated from the sort/op patterns, compiled on first use.
+     * Shared by copies of a Theory, which have the same patterns.
+     */
+    struct TermParser
+    {
+        std::once_flag compiled;
+        std::unique_ptr<peg::parser> parser;
+    };
+    std::shared_ptr<TermParser> termparser;
+
+    const peg::parser &term_parser() const;
+
     void validate_theory();
     SortDeclDict make_sdict(std::vector<SortDecl> s);
     OpDeclDict make_odict(std::vector<OpDecl> o);
@@ -304,10 +534,11 @@ private:
     std::string mkParser() const;
     Expr ast_to_expr(const std::shared_ptr<peg::Ast> &ast) const;
 
-    static SortDecl parseSort(std::shared_ptr<peg::Ast> ast, KindDict kd);
-    static OpDecl parseOp(std::shared_ptr<peg::Ast> ast, KindDict kd);
-    static Rule parseRule(std::shared_ptr<peg::Ast> ast, KindDict kd);
-    static Expr parseExpr(std::shared_ptr<peg::Ast> ast, KindDict kd);
+    /**
+     * Symbols of a declaration dictionary, in alphabetical order
+     */
+    template <typename T>
+    static std::vector<Sym> sorted_syms(const std::map<Sym, T> &dict);
 };
 
 /**
@@ -2,6 +2,7 @@
 #include "../src/astextra_basic.hpp"
 #include "../src/astextra.hpp"
 #include "../src/cvc4extra.hpp"
+#include "../src/rewrite.hpp"
 #include "../src/theories/theories.hpp"
 
 TEST_CASE("cart_product")
@@ -39,7 +40,7 @@ TEST_CASE("replace1")
     smt::Datatype dt = astSort->get_datatype();
 
     // Max args is 3 due to `write` function, + 1 for sort information
-    CHECK(arity(astSort) == 4);
+    CHECK(arity(slv, astSort) == 4);
 
     // Create some terms to test on
     smt::Term seven = slv->make_term(7, Int);
@@ -132,6 +133,68 @@ TEST_CASE("replPfun")
 
 TEST_CASE("subterm")
 {
+    smt::SmtSolver slv = smt::CVC4SolverFactory::create(false);
+    Theory t = cat().upgrade();
+    smt::Sort astSort;
+    std::tie(astSort, std::ignore, std::ignore) = create_datatypes(slv, t, 3);
+    smt::Term x = construct(slv, astSort, t, t.rules.at(2).t1);
+
+    // Each prefix is built once, and gives the same term as the whole chain
+    Subterms xs(slv, x);
+    CHECK(xs.at({}) == x);
+    CHECK(xs.at({1, 0}) == subterm(slv, x, {1, 0}));
+    CHECK(xs.size() == 3);
+    CHECK(xs.at({1, 1}) == subterm(slv, x, {1, 1}));
+    CHECK(xs.at({1}) == subterm(slv, x, {1}));
+    CHECK(xs.size() == 4);
+    CHECK(replP_fun(slv, x, x, {1, 1}, &xs) == replP_fun(slv, x, x, {1, 1}));
+    CHECK(xs.size() == 4);
+}
+
+TEST_CASE("Handles")
+{
+    smt::SmtSolver slv = smt::CVC4SolverFactory::create(false);
+    Theory t = cat().upgrade();
+    smt::Sort astSort, pathSort;
+    std::tie(astSort, pathSort, std::ignore) = create_datatypes(slv, t, 2);
+    smt::Term x = construct(slv, astSort, t, t.rules.at(2).t1);
+
+    // The same terms come out with and without handles
+    smt::Term a1 = getarg(slv, x, 1), n = node(slv, x), e = test(slv, x, "Error");
+    smt::Term none = unit(slv, astSort, "None"), p = unit(slv, pathSort, "P1");
+    smt::Sort ns = nodesort(slv, astSort);
+    int n_args = arity(slv, astSort);
+    CHECK(Handles::current(slv) == nullptr);
+    {
+        Handles handles(slv);
+        Handles::Use use(handles);
+        CHECK(Handles::current(slv) == &handles);
+        CHECK(getarg(slv, x, 1) == a1);
+        CHECK(node(slv, x) == n);
+        CHECK(test(slv, x, "Error") == e);
+        CHECK(unit(slv, astSort, "None") == none);
+        CHECK(unit(slv, pathSort, "P1") == p);
+        CHECK(nodesort(slv, astSort) == ns);
+        CHECK(arity(slv, astSort) == n_args);
+        CHECK(construct(slv, astSort, t, t.rules.at(2).t1) == x);
+        {
+            Handles inner(slv);
+            Handles::Use use2(inner);
+            CHECK(Handles::current(slv) == &inner);
+        }
+        CHECK(Handles::current(slv) == &handles);
+
+        // Terms of another solver are encoded without the active handles
+        smt::SmtSolver other = smt::CVC4SolverFactory::create(false);
+        smt::Sort otherAst;
+        std::tie(otherAst, std::ignore, std::ignore) = create_datatypes(other, t, 2);
+        CHECK(Handles::current(other) == nullptr);
+        smt::Term y = construct(other, otherAst, t, t.rules.at(2).t1);
+        CHECK(getarg(other, y, 1)->get_sort() == otherAst);
+        CHECK(arity(other, otherAst) == n_args);
+        CHECK(unit(other, otherAst, "None") != none);
+    }
+    CHECK(Handles::current(slv) == nullptr);
 }
 
 TEST_CASE("parseCVC")
@@ -162,3 +225,30 @@ TEST_CASE("parseCVC")
 
     writeModel(slv, "test/parsecvc.dat");
 }
+
+TEST_CASE("parseCVC bit-vectors")
+{
+    // Same round trip with bit-vector node symbols
+    smt::SmtSolver slv = smt::CVC4SolverFactory::create(false);
+    slv->set_opt("produce-models", "true");
+    Theory t = cat().upgrade();
+    smt::Sort astSort;
+    std::tie(astSort, std::ignore, std::ignore) = create_datatypes(slv, t, 2, {Encoding::Enumerated, Encoding::BitVectors});
+    CHECK(nodesort(slv, astSort)->get_width() == 16);
+    CHECK(stepsort(slv, astSort)->get_width() == 16 - 1 - offset_bits);
+
+    Expr o = Srt("Ob"), q = Var("Q", {o}), z = Var("Z", {o});
+    Expr h = Srt("Hom", {q, z}), m = Var("m", {h});
+    for (auto &&expr : {t.rules.at(0).t2, m})
+    {
+        smt::Term x = mkConst(slv, "x", construct(slv, astSort, t, expr));
+        slv->check_sat();
+        CHECK((parseCVC(t, slv->get_value(x)->to_string()) == expr));
+    }
+
+    // Free variables keep the step which introduced them
+    smt::Term step = slv->make_term(3, stepsort(slv, astSort));
+    smt::Term f = mkConst(slv, "f", ast(slv, astSort, mkfresh(slv, astSort, step, 2)));
+    slv->check_sat();
+    CHECK(parseCVC(t, slv->get_value(f)->to_string()).sym == freshvar(3, 2));
+}
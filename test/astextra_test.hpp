@@ -134,6 +134,97 @@ TEST_CASE("replaceAt")
     writeModel(slv, "test/replaceat.dat");
 }
 
+TEST_CASE("getAtLevels")
+{
+    // Same as getAt, with the per-level path encoding
+    smt::SmtSolver slv = smt::CVC4SolverFactory::create(false);
+    slv->set_opt("produce-models", "true");
+    slv->set_opt("incremental", "true");
+    Theory t = cat().upgrade();
+    smt::Sort astSort, pathSort;
+    std::tie(astSort, pathSort, std::ignore) = create_datatypes(slv, t, 2, {Encoding::Levels});
+
+    Expr f_gh = t.rules.at(2).t1;
+    Expr f = f_gh.args.at(1);
+    Expr g = f_gh.args.at(2).args.at(1);
+    smt::Term f_gh1 = construct(slv, astSort, t, f_gh);
+
+    smt::Term f_gh2 = mkConst(slv, "f_gh", getAtLevels(slv, f_gh1, mkPath(slv, pathSort, {})));
+    smt::Term f2 = getAtLevels(slv, f_gh1, mkPath(slv, pathSort, {1}));
+    smt::Term g2 = getAtLevels(slv, f_gh1, mkPath(slv, pathSort, {2, 1}));
+    smt::Term h2 = getAtLevels(slv, f_gh1, mkPath(slv, pathSort, {2, 2}));
+
+    CHECK(check_equal(slv, astSort, t, f_gh2, f_gh));
+    CHECK(check_equal(slv, astSort, t, f2, f));
+    CHECK(check_equal(slv, astSort, t, g2, g));
+    CHECK_FALSE(check_equal(slv, astSort, t, h2, g));
+
+    // A path which is not well formed has no subterm
+    smt::Sort Int = slv->make_sort(smt::INT);
+    smt::Term bad = slv->make_term(smt::Apply_Constructor,
+                                   {slv->get_constructor(pathSort, "path"),
+                                    slv->make_term(1, Int),
+                                    slv->make_term(1, Int),
+                                    slv->make_term(1, Int)});
+    smt::Term err = getAtLevels(slv, f_gh1, bad);
+    CHECK(slv->check_sat_assuming({ntest(slv, err, "Error")}).is_unsat());
+}
+
+TEST_CASE("replaceAtLevels")
+{
+    // Same as replaceAt, with the per-level path encoding
+    smt::SmtSolver slv = smt::CVC4SolverFactory::create(false);
+    slv->set_opt("produce-models", "true");
+    Theory t = monoid().upgrade();
+    smt::Sort astSort, pathSort;
+    std::tie(astSort, pathSort, std::ignore) = create_datatypes(slv, t, 2, {Encoding::Levels});
+
+    Expr x_yz = t.rules.at(2).t1, x = x_yz.args.at(1);
+    Expr u_xyz = x_yz.uninfer();
+    Expr ux = x.uninfer(), uy = u_xyz.args.at(1).args.at(0);
+    Expr x_yx = t.upgrade(App("M", {ux, App("M", {uy, ux})}));
+
+    smt::Term xyz_ = mkConst(slv, "xyz", construct(slv, astSort, t, x_yz));
+    smt::Term x_ = mkConst(slv, "x", construct(slv, astSort, t, x));
+    smt::Term result = mkConst(slv, "result", replaceAtLevels(slv, xyz_, x_, mkPath(slv, pathSort, {2, 2})));
+    smt::Term x2 = replaceAtLevels(slv, xyz_, x_, mkPath(slv, pathSort, {}));
+
+    CHECK(check_equal(slv, astSort, t, result, x_yx));
+    CHECK(check_equal(slv, astSort, t, x2, x));
+}
+
+TEST_CASE("redundant")
+{
+    smt::SmtSolver slv = smt::CVC4SolverFactory::create(false);
+    slv->set_opt("produce-models", "true");
+    slv->set_opt("incremental", "true");
+    Theory t = cat().upgrade();
+    smt::Sort astSort, pathSort, ruleSort;
+    std::tie(astSort, pathSort, ruleSort) = create_datatypes(slv, t, 2, {Encoding::Levels});
+
+    smt::Term x = construct(slv, astSort, t, t.rules.at(2).t1);
+    smt::Term y = construct(slv, astSort, t, t.rules.at(2).t2);
+    smt::Term asf = unit(slv, ruleSort, "R3f"), asr = unit(slv, ruleSort, "R3r");
+    smt::Term p1 = mkPath(slv, pathSort, {1}), p2 = mkPath(slv, pathSort, {2});
+    smt::Term p21 = mkPath(slv, pathSort, {2, 1}), p22 = mkPath(slv, pathSort, {2, 2});
+    auto holds = [&](const smt::Term &b) {
+        return slv->check_sat_assuming({slv->make_term(smt::Not, b)}).is_unsat();
+    };
+
+    // Steps which change nothing
+    CHECK(holds(redundant(slv, t, x, x, asf, p1, asf, p2, 2, {Encoding::Levels})));
+
+    // Undoing the previous step
+    CHECK(holds(redundant(slv, t, x, y, asr, p1, asf, p1, 2, {Encoding::Levels})));
+    CHECK_FALSE(holds(redundant(slv, t, x, y, asf, p1, asf, p1, 2, {Encoding::Levels})));
+
+    // Commuting steps are only taken left to right
+    CHECK(holds(redundant(slv, t, x, y, asf, p1, asf, p2, 2, {Encoding::Levels})));
+    CHECK(holds(redundant(slv, t, x, y, asf, p21, asf, p22, 2, {Encoding::Levels})));
+    CHECK_FALSE(holds(redundant(slv, t, x, y, asf, p2, asf, p1, 2, {Encoding::Levels})));
+    CHECK_FALSE(holds(redundant(slv, t, x, y, asf, p21, asf, p2, 2, {Encoding::Levels})));
+}
+
 TEST_CASE("rewriteTop")
 {
 }
@@ -0,0 +1,46 @@
+#include "../external/catch.hpp"
+#include "../src/batch.hpp"
+#include "../src/theories/theories.hpp"
+
+TEST_CASE("batch unrolling")
+{
+    smt::SmtSolver slv = smt::CVC4SolverFactory::create(false);
+    slv->set_opt("produce-models", "true");
+    slv->set_opt("incremental", "true");
+    Theory t = cat().upgrade();
+    Unrolling u(slv, t, 3);
+
+    Expr xid = t.upgrade(t.parse_expr("(x:(A:Ob⇒Q:Ob) ⋅ id(Q:Ob))"));
+    Expr idx = t.upgrade(t.parse_expr("(id(A:Ob) ⋅ x:(A:Ob⇒Q:Ob))"));
+    Expr x = t.upgrade(t.parse_expr("x:(A:Ob⇒Q:Ob)"));
+    Expr y = t.upgrade(t.parse_expr("y:(A:Ob⇒Q:Ob)"));
+
+    // Queries share the encoding, and do not constrain each other
+    SearchResult r1 = u.check(xid, x, 3);
+    REQUIRE(r1.status == SearchResult::Found);
+    CHECK(r1.steps.size() == 1);
+    CHECK(u.check(xid, y, 3).status == SearchResult::NotFound);
+    SearchResult r2 = u.check(xid, idx, 4);
+    REQUIRE(r2.status == SearchResult::Found);
+    CHECK(r2.steps.size() == 2);
+    CHECK(r2.steps.back().result == idx);
+}
+
+TEST_CASE("batch unrolling with bit-vectors")
+{
+    smt::SmtSolver slv = smt::CVC4SolverFactory::create(false);
+    slv->set_opt("produce-models", "true");
+    slv->set_opt("incremental", "true");
+    Theory t = cat().upgrade();
+    Unrolling u(slv, t, 3, "", {Encoding::Enumerated, Encoding::BitVectors});
+
+    Expr xid = t.upgrade(t.parse_expr("(x:(A:Ob⇒Q:Ob) ⋅ id(Q:Ob))"));
+    Expr x = t.upgrade(t.parse_expr("x:(A:Ob⇒Q:Ob)"));
+    Expr y = t.upgrade(t.parse_expr("y:(A:Ob⇒Q:Ob)"));
+
+    SearchResult r = u.check(xid, x, 3);
+    REQUIRE(r.status == SearchResult::Found);
+    CHECK(r.steps.size() == 1);
+    CHECK(r.steps.back().result == x);
+    CHECK(u.check(xid, y, 3).status == SearchResult::NotFound);
+}
@@ -0,0 +1,53 @@
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "../external/catch.hpp"
+#include "../src/cache.hpp"
+#include "../src/theories/theories.hpp"
+
+TEST_CASE("cached_rewrite")
+{
+    smt::SmtSolver slv = smt::CVC4SolverFactory::create(false);
+    slv->set_opt("produce-models", "true");
+    slv->set_opt("incremental", "true");
+    Theory t = cat().upgrade();
+    const std::string dir = "build/testcache";
+    std::filesystem::remove_all(dir);
+
+    smt::Sort astSort, pathSort, ruleSort;
+    std::tie(astSort, pathSort, ruleSort) = create_datatypes(slv, t, 2);
+    smt::Term x = slv->make_symbol("x", astSort);
+    smt::Term r = slv->make_symbol("r", ruleSort);
+    smt::Term p = slv->make_symbol("p", pathSort);
+    smt::Term n = slv->make_symbol("n", slv->make_sort(smt::INT));
+
+    // First call saves the encoding, second one loads it
+    smt::Term built = cached_rewrite(slv, t, astSort, pathSort, ruleSort, x, r, p, n, 2, {}, dir);
+    REQUIRE(std::filesystem::exists(cache_path(t, 2, {}, dir)));
+    smt::Term loaded = cached_rewrite(slv, t, astSort, pathSort, ruleSort, x, r, p, n, 2, {}, dir);
+    smt::Term differ = slv->make_term(smt::Not, slv->make_term(smt::Equal, built, loaded));
+    CHECK(slv->check_sat_assuming({differ}).is_unsat());
+
+    // Operators are saved by name, and an unknown one means rebuilding
+    {
+        std::ifstream in(cache_path(t, 2, {}, dir));
+        std::stringstream ss;
+        ss << in.rdbuf();
+        std::string content = ss.str();
+        size_t op = content.find("\nO ");
+        REQUIRE(op != std::string::npos);
+        CHECK(std::isalpha((unsigned char)content.at(op + 3)));
+        content.replace(op + 3, content.find(' ', op + 3) - op - 3, "Bogus");
+        std::ofstream(cache_path(t, 2, {}, dir)) << content;
+    }
+    smt::Term rebuilt = cached_rewrite(slv, t, astSort, pathSort, ruleSort, x, r, p, n, 2, {}, dir);
+    differ = slv->make_term(smt::Not, slv->make_term(smt::Equal, built, rebuilt));
+    CHECK(slv->check_sat_assuming({differ}).is_unsat());
+
+    // Other depths, encodings and theories have their own entries
+    CHECK(cache_path(t, 2, {}, dir) != cache_path(t, 3, {}, dir));
+    CHECK(cache_path(t, 2, {}, dir) != cache_path(t, 2, {Encoding::Levels}, dir));
+    CHECK(cache_path(t, 2, {}, dir) != cache_path(monoid().upgrade(), 2, {}, dir));
+    std::filesystem::remove_all(dir);
+}
@@ -1,5 +1,6 @@
 #include "../external/catch.hpp"
 #include "../src/cvc4extra.hpp"
+#include "../src/instrument.hpp"
 
 TEST_CASE("mkConst")
 {
@@ -42,3 +43,33 @@ TEST_CASE("ITE")
     // ifs and thens don't have same size
     CHECK_THROWS(ITE(slv, {Else, Else}, {Else}, Else));
 }
+
+TEST_CASE("TermCount")
+{
+    smt::SmtSolver slv = smt::CVC4SolverFactory::create(false);
+    smt::Sort Int = slv->make_sort(smt::INT);
+    smt::Term x = slv->make_symbol("x", Int), one = slv->make_term(1, Int);
+    smt::Term c = slv->make_term(smt::Gt, x, one);
+
+    Instrument::reset();
+    Instrument::enable();
+    // x > 1, x, 1 and the ITE itself are new; the second call only adds the ITE
+    ITE(slv, {c}, {x}, one);
+    ITE(slv, {c}, {one}, x);
+    Instrument::enable(false);
+    CHECK(Instrument::counters().at("ITE").calls == 2);
+    CHECK(Instrument::counters().at("ITE").terms == 5);
+    Instrument::reset();
+}
+
+TEST_CASE("make_solver")
+{
+    smt::SmtSolver slv = make_solver("cvc4", true);
+    smt::Sort Int = slv->make_sort(smt::INT);
+    smt::Term x = mkConst(slv, "x", slv->make_term(9, Int));
+    REQUIRE(slv->check_sat().is_sat());
+    CHECK(slv->get_value(x)->to_string() == "9");
+
+    CHECK_THROWS(make_solver("nosuchsolver"));
+    CHECK_THROWS(make_solver("btor"));
+}
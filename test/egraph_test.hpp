@@ -0,0 +1,41 @@
+#include "../external/catch.hpp"
+#include "../src/egraph.hpp"
+#include "../src/theories/theories.hpp"
+
+TEST_CASE("egraph congruence")
+{
+    Theory t = cat().upgrade();
+    EGraph g(t);
+
+    // id(A)⋅f and f are merged by idl, and so are their uses as arguments
+    Expr f = t.rules.at(0).t1, idf = t.rules.at(0).t2;
+    int a = g.add(f), b = g.add(idf);
+    CHECK(g.find(a) != g.find(b));
+    CHECK(g.apply_rules());
+    CHECK(g.find(a) == g.find(b));
+
+    Steps s = g.explain(b, a);
+    REQUIRE(s.size() == 1);
+    CHECK(s.at(0).rule == 1);
+    CHECK_FALSE(s.at(0).forward);
+    CHECK(s.at(0).result == f);
+}
+
+TEST_CASE("egraph_search")
+{
+    Theory t = cat().upgrade();
+    Expr initial = t.upgrade(t.parse_expr("(x:(A:Ob⇒Q:Ob) ⋅ id(Q:Ob))"));
+    Expr final = t.upgrade(t.parse_expr("(id(A:Ob) ⋅ x:(A:Ob⇒Q:Ob))"));
+
+    SearchResult res = egraph_search(t, initial, final);
+    REQUIRE(res.status == SearchResult::Found);
+    CHECK(res.steps.back().result == final);
+
+    // Array theory: several rounds, with rewrites inside the term
+    Theory n = natarray().upgrade();
+    Expr i2 = n.upgrade(n.parse_expr("read(write(write(A:Arr,S(0),p:Ob),0,o:Ob),S(0))"));
+    Expr f2 = n.upgrade(n.parse_expr("p:Ob"));
+    SearchResult res2 = egraph_search(n, i2, f2);
+    REQUIRE(res2.status == SearchResult::Found);
+    CHECK(res2.steps.back().result == f2);
+}
@@ -0,0 +1,47 @@
+#include "../external/catch.hpp"
+#include "../src/instrument.hpp"
+
+TEST_CASE("Instrument")
+{
+    Instrument::reset();
+    {
+        Instrument::Scope off("ignored");
+        Instrument::count("ast", 1, 1);
+    }
+    CHECK(Instrument::spans().empty());
+
+    Instrument::enable();
+    {
+        Instrument::Scope outer("encode");
+        Instrument::Scope inner("check_until 0");
+    }
+    CHECK(Instrument::see(7));
+    CHECK(Instrument::see(8));
+    CHECK(!Instrument::see(7));
+    CHECK(Instrument::seen() == 2);
+    Instrument::count("ast", 2, Instrument::seen());
+    Instrument::enable(false);
+
+    // Spans are logged as they end
+    std::vector<Instrument::Span> sp = Instrument::spans();
+    REQUIRE(sp.size() == 2);
+    CHECK(sp.at(0).name == "check_until 0");
+    CHECK(sp.at(0).level == 1);
+    CHECK(sp.at(1).level == 0);
+    CHECK(sp.at(1).start <= sp.at(0).start);
+    CHECK(sp.at(1).duration >= sp.at(0).duration);
+    CHECK(Instrument::counters().at("ast").calls == 3);
+    CHECK(Instrument::counters().at("ast").terms == 3);
+
+    std::string json = Instrument::json();
+    CHECK(json.find("\"encode\": ") != std::string::npos);
+    CHECK(json.find("\"ast\": {\"calls\": 3, \"terms\": 3}") != std::string::npos);
+    std::string trace = Instrument::trace();
+    CHECK(trace.find("\"ph\": \"X\"") != std::string::npos);
+    CHECK(trace.find("\"ph\": \"C\"") != std::string::npos);
+
+    Instrument::reset();
+    CHECK(Instrument::spans().empty());
+    CHECK(Instrument::counters().empty());
+    CHECK(Instrument::seen() == 0);
+}
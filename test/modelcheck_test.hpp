@@ -0,0 +1,59 @@
+#include "../external/catch.hpp"
+#include "../src/modelcheck.hpp"
+#include "../src/rewrite.hpp"
+#include "../src/theories/theories.hpp"
+
+TEST_CASE("rule variable with two sort spellings")
+{
+    // f∘f to f, for an f written both as A→B and B→A (so A=B)
+    Expr A = Var("A", Srt("Ob")), B = Var("B", Srt("Ob"));
+    Expr fab = Var("f", Srt("Hom", {A, B})), fba = Var("f", Srt("Hom", {B, A}));
+    Theory c = cat();
+    Theory t = Theory("idem", c.sorts, c.ops,
+                      {{"idem", "", App("cmp", {fab, fba}), Var("f", Srt("Hom", {A, A}))}})
+                   .upgrade();
+
+    // Both occurrences must bind the same morphism, which the output copies
+    // (rather than building a variable f)
+    Expr ida = t.upgrade(App("id", {A}));
+    Expr idid = t.upgrade(App("cmp", {ida, ida}));
+    std::optional<Expr> y = rewrite_top(t, idid, 1, true, 0);
+    REQUIRE(y);
+    CHECK(*y == ida);
+    Expr fg = t.upgrade(App("cmp", {fab, Var("g", Srt("Hom", {B, A}))}));
+    CHECK_FALSE(rewrite_top(t, fg, 1, true, 0));
+
+    // The SMT encoding agrees
+    SearchResult found = mc_search(t, idid, ida, 1, 1, "", "");
+    CHECK(found.status == SearchResult::Found);
+    CHECK(found.steps.size() == 1);
+    CHECK(mc_search(t, idid, t.upgrade(Var("f", Srt("Hom", {A, A}))), 1, 1, "", "").status != SearchResult::Found);
+    CHECK(mc_search(t, fg, t.upgrade(Var("f", Srt("Hom", {A, A}))), 2, 1, "", "").status != SearchResult::Found);
+}
+
+TEST_CASE("mc_search proves a term unreachable")
+{
+    // No rule has 0 on its right, and 0 has no subterm to rewrite, so no
+    // step leads to it from anywhere: "not 0" is itself inductive
+    Theory n = natarray().upgrade();
+    Expr x = n.upgrade(n.parse_expr("ite(⊤,o:Ob,p:Ob)"));
+    Expr z = n.upgrade(App("Z"));
+    for (std::string engine : {"kind", "ic3"})
+    {
+        SearchResult res = mc_search(n, x, z, 3, 2, "", "", {}, engine);
+        CHECK(res.status == SearchResult::Refuted);
+        if (engine == "ic3")
+            CHECK_FALSE(res.invariant.empty());
+    }
+}
+
+TEST_CASE("mc_search without variables introduced")
+{
+    // Monoid rules never introduce variables, so there is no step counter
+    Theory m = monoid().upgrade();
+    Expr e = m.upgrade(App("e"));
+    Expr mee = m.upgrade(App("M", {App("M", {App("e"), App("e")}), App("e")}));
+    SearchResult res = mc_search(m, mee, e, 2, 2, "", "");
+    CHECK(res.status == SearchResult::Found);
+    CHECK(res.steps.size() == 2);
+}
@@ -0,0 +1,56 @@
+#include "../external/catch.hpp"
+#include "../src/pattern.hpp"
+#include "../src/rewrite.hpp"
+#include "../src/theories/theories.hpp"
+
+TEST_CASE("Pattern")
+{
+    for (auto &&t0 : alltheories())
+    {
+        Theory t = t0.upgrade();
+        for (int r = 1; r <= t.rules.size(); r++)
+        {
+            for (auto &&forward : {true, false})
+            {
+                const Pattern &pat = t.program(r, forward);
+                const Expr &src = forward ? t.rules.at(r - 1).t1 : t.rules.at(r - 1).t2;
+                const Expr &tar = forward ? t.rules.at(r - 1).t2 : t.rules.at(r - 1).t1;
+                CHECK(pat.rule == r);
+                CHECK(pat.forward == forward);
+                CHECK(pat.fresh == has_freevar(t, r, forward));
+
+                // Checks are in preorder, starting from the root
+                if (src.kind != Expr::VarNode)
+                {
+                    REQUIRE_FALSE(pat.checks.empty());
+                    CHECK(pat.checks.front().path.empty());
+                }
+                for (size_t i = 1; i < pat.checks.size(); i++)
+                    CHECK(pat.checks.at(i - 1).path < pat.checks.at(i).path);
+
+                // A pattern matches itself, giving the other side
+                if (!pat.fresh)
+                {
+                    std::optional<Expr> y = rewrite_top(t, src, r, forward, 0);
+                    REQUIRE(y);
+                    CHECK(*y == tar);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Pattern nonlinear")
+{
+    // Reverse distributivity: ((x∧y)∨(x∧z)) to (x∧(y∨z)) needs both x to match
+    Theory t = boolalg().upgrade();
+    const Pattern &pat = t.program(7, false);
+    CHECK_FALSE(pat.same.empty());
+
+    Expr good = t.upgrade(t.parse_expr("((⊤∧⊥)∨(⊤∧⊤))"));
+    Expr bad = t.upgrade(t.parse_expr("((⊤∧⊥)∨(⊥∧⊤))"));
+    std::optional<Expr> y = rewrite_top(t, good, 7, false, 0);
+    REQUIRE(y);
+    CHECK(*y == t.upgrade(t.parse_expr("(⊤∧(⊥∨⊤))")));
+    CHECK_FALSE(rewrite_top(t, bad, 7, false, 0));
+}
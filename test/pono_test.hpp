@@ -13,6 +13,7 @@
 #undef TRUE
 #include "core/fts.h"
 #include "engines/bmc.h"
+#include "engines/kinduction.h"
 #include "utils/logger.h"
 #include "utils/logger.h"
 
@@ -71,6 +72,30 @@ TEST_CASE("transition system")
   CHECK(witres == expected);
 }
 
+TEST_CASE("k-induction")
+{
+  // Same counter, with a true property: cnt < 6
+  smt::SmtSolver s = smt::CVC4SolverFactory::create(false);
+  s->set_opt("produce-models", "true");
+  s->set_opt("incremental", "true");
+  pono::FunctionalTransitionSystem fts(s);
+
+  smt::Sort bvsort4 = s->make_sort(smt::BV, 4);
+  smt::Term cnt = fts.make_statevar("cnt", bvsort4);
+  fts.constrain_init(s->make_term(smt::Equal, cnt, s->make_term(0, bvsort4)));
+  fts.assign_next(cnt, s->make_term(
+                           smt::Ite,
+                           s->make_term(smt::BVUlt, cnt, s->make_term(5, bvsort4)),
+                           s->make_term(smt::BVAdd, cnt, s->make_term(1, bvsort4)),
+                           s->make_term(0, bvsort4)));
+  smt::Term p = s->make_term(smt::BVUlt, cnt, s->make_term(6, bvsort4));
+  pono::Property prop(s, p);
+
+  // Holds for any number of steps (BMC could only say it holds up to 10)
+  pono::KInduction kind(prop, fts, s);
+  CHECK(kind.check_until(10) == pono::TRUE);
+}
+
 TEST_CASE("transition2")
 {
   // Initialize SMTsolver and transition system
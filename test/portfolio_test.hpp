@@ -0,0 +1,98 @@
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../external/catch.hpp"
+#include "../src/portfolio.hpp"
+#include "../src/search.hpp"
+#include "../src/egraph.hpp"
+#include "../src/theories/theories.hpp"
+
+TEST_CASE("portfolio")
+{
+    Theory t = cat().upgrade();
+    Expr initial = t.upgrade(t.parse_expr("(x:(A:Ob⇒Q:Ob) ⋅ id(Q:Ob))"));
+    Expr final = t.upgrade(t.parse_expr("(id(A:Ob) ⋅ x:(A:Ob⇒Q:Ob))"));
+    std::string winner;
+
+    // A job that never finishes is cancelled once another one answers
+    std::vector<Job> jobs{
+        {"stuck", [] { while (true) sleep(1); return SearchResult{SearchResult::Error, {}}; }},
+        {"shallow", [&] { return native_search(t, initial, final, 1, 3); }},
+        {"native", [&] { return native_search(t, initial, final, 10, 3); }}};
+    SearchResult res = portfolio(t, initial, jobs, 0, winner);
+    REQUIRE(res.status == SearchResult::Found);
+    CHECK(winner == "native");
+    CHECK(res.steps.size() == 2);
+    CHECK(res.steps.back().result == final);
+
+    // Nothing definitive before the timeout
+    std::vector<Job> slow{jobs.at(0), jobs.at(1)};
+    CHECK(portfolio(t, initial, slow, 1, winner).status == SearchResult::NotFound);
+    CHECK(winner.empty());
+
+    // An unbounded witness past the query's bounds is no answer
+    std::vector<Job> unbounded{
+        {"egraph", [&] { return within_bounds(egraph_search(t, initial, final), 1, 3); }},
+        {"shallow", [&] { return native_search(t, initial, final, 1, 3); }}};
+    CHECK(portfolio(t, initial, unbounded, 0, winner).status == SearchResult::NotFound);
+    CHECK(winner.empty());
+    REQUIRE(egraph_search(t, initial, final).status == SearchResult::Found);
+    CHECK(within_bounds(egraph_search(t, initial, final), 10, 3).status == SearchResult::Found);
+}
+
+TEST_CASE("portfolio keeps the invariant")
+{
+    Theory t = cat().upgrade();
+    Expr initial = t.upgrade(t.parse_expr("id(A:Ob)"));
+    std::string winner;
+    const std::string inv = "(not (= state\n(ast 7 None)))";
+    std::vector<Job> jobs{{"kind", [&] { return SearchResult{SearchResult::Refuted, {}, inv}; }}};
+    SearchResult res = portfolio(t, initial, jobs, 0, winner);
+    CHECK(res.status == SearchResult::Refuted);
+    CHECK(res.invariant == inv);
+
+    jobs = {{"bmc", [] { return SearchResult{SearchResult::Refuted, {}}; }}};
+    res = portfolio(t, initial, jobs, 0, winner);
+    CHECK(res.status == SearchResult::Refuted);
+    CHECK(res.invariant.empty());
+}
+
+TEST_CASE("portfolio cleans up when a job cannot start")
+{
+    Theory t = cat().upgrade();
+    Expr initial = t.upgrade(t.parse_expr("id(A:Ob)"));
+    std::string winner;
+    auto stuck = [] { while (true) sleep(1); return SearchResult{SearchResult::Error, {}}; };
+    std::vector<Job> jobs{{"stuck", stuck}, {"stuck too", stuck}};
+
+    // Leave room for exactly one pipe, so the second job cannot be started
+    int lowest = open("/dev/null", O_RDONLY);
+    REQUIRE(lowest >= 0);
+    close(lowest);
+    rlimit old;
+    getrlimit(RLIMIT_NOFILE, &old);
+    rlimit tight = old;
+    tight.rlim_cur = lowest + 2;
+    setrlimit(RLIMIT_NOFILE, &tight);
+    CHECK_THROWS(portfolio(t, initial, jobs, 0, winner));
+    setrlimit(RLIMIT_NOFILE, &old);
+
+    // The first job was killed and reaped, and its pipe closed
+    CHECK(waitpid(-1, nullptr, WNOHANG) == -1);
+    int next = open("/dev/null", O_RDONLY);
+    CHECK(next == lowest);
+    close(next);
+}
+
+TEST_CASE("within_bounds")
+{
+    Theory t = cat().upgrade();
+    Expr x = t.upgrade(t.parse_expr("(x:(A:Ob⇒Q:Ob) ⋅ id(Q:Ob))"));
+    SearchResult deep{SearchResult::Found, {{1, true, {2, 1}, x}}};
+    CHECK(within_bounds(deep, 1, 2).status == SearchResult::Found);
+    CHECK(within_bounds(deep, 1, 1).status == SearchResult::NotFound);
+    CHECK(within_bounds(deep, 0, 2).status == SearchResult::NotFound);
+    SearchResult refuted{SearchResult::Refuted, {}};
+    CHECK(within_bounds(refuted, 0, 0).status == SearchResult::Refuted);
+}
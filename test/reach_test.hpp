@@ -0,0 +1,64 @@
+#include <deque>
+#include <unordered_set>
+#include "../external/catch.hpp"
+#include "../src/reach.hpp"
+#include "../src/rewrite.hpp"
+#include "../src/theories/theories.hpp"
+
+// Every rewrite found by exploring from the initial term must be allowed
+static void check_reach(const Theory &t, const Expr &initial, const int &depth, const size_t &max_states)
+{
+    Reach reach(t, depth, {initial});
+    std::unordered_set<Expr> seen{initial};
+    std::deque<Expr> todo{initial};
+    while (!todo.empty() && seen.size() < max_states)
+    {
+        Expr x = todo.front();
+        todo.pop_front();
+        for (auto &&s : successors(t, x, 1, depth))
+        {
+            CHECK(reach.fires(s.rule, s.forward, s.path.size()));
+            CHECK(reach.useful(s.path));
+            CHECK(reach.fires_at(s.rule, s.forward, s.path));
+            if (seen.insert(s.result).second)
+                todo.push_back(s.result);
+        }
+    }
+}
+
+TEST_CASE("Reach is sound")
+{
+    Theory c = cat().upgrade();
+    check_reach(c, c.upgrade(c.parse_expr("(x:(A:Ob⇒Q:Ob) ⋅ id(Q:Ob))")), 3, 300);
+
+    Theory m = monoid().upgrade();
+    check_reach(m, m.rules.at(2).t1, 2, 300);
+
+    Theory b = boolalg().upgrade();
+    check_reach(b, b.upgrade(b.parse_expr("((⊤∧⊥)∨(⊤∧⊤))")), 2, 300);
+
+    Theory n = natarray().upgrade();
+    check_reach(n, n.rules.at(0).t1, 3, 300);
+}
+
+TEST_CASE("Reach prunes")
+{
+    // No rule builds a read out of anything else, so read over write never
+    // applies in either direction
+    Theory n = natarray().upgrade();
+    Expr x = n.upgrade(n.parse_expr("ite(⊤,o:Ob,p:Ob)"));
+    Reach reach(n, 2, {x});
+    CHECK_FALSE(reach.fires(1, true));
+    CHECK_FALSE(reach.fires(1, false));
+    CHECK(reach.fires(6, true, 0));
+    CHECK(reach.fires_at(6, true, {}));
+    CHECK_FALSE(reach.fires_at(6, true, {1}));
+
+    // The sorts of the leaves are never rewritten
+    CHECK(reach.useful({}));
+    CHECK_FALSE(reach.useful({1, 0}));
+    CHECK_FALSE(reach.useful({7}));
+
+    CHECK(reach.key() == Reach(n, 2, {x}).key());
+    CHECK(reach.key() != Reach(n, 2, {n.rules.at(0).t1}).key());
+}
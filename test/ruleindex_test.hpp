@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <set>
+#include "../external/catch.hpp"
+#include "../src/rewrite.hpp"
+#include "../src/ruleindex.hpp"
+#include "../src/theories/theories.hpp"
+
+TEST_CASE("RuleIndex")
+{
+    for (auto &&t0 : alltheories())
+    {
+        Theory t = t0.upgrade();
+        const RuleIndex &idx = t.rule_index();
+
+        // Terms to look up: every subterm of every rule side
+        Ve terms;
+        for (auto &&r : t.rules)
+        {
+            for (auto &&side : {r.t1, r.t2})
+            {
+                for (auto &&x : side.positions().terms)
+                    terms.push_back(x);
+            }
+        }
+
+        for (auto &&x : terms)
+        {
+            std::vector<RuleIndex::Candidate> cands = idx.candidates(x);
+            std::set<RuleIndex::Candidate> cs(cands.begin(), cands.end());
+            const std::vector<RuleIndex::Candidate> &tops = idx.candidates(x.sym, x.args.size());
+            std::set<RuleIndex::Candidate> ts(tops.begin(), tops.end());
+
+            // No rule which applies is missing
+            for (int r = 1; r <= t.rules.size(); r++)
+            {
+                for (auto &&forward : {true, false})
+                {
+                    if (rewrite_top(t, x, r, forward, 0))
+                        CHECK(cs.count({r, forward}));
+                }
+            }
+            // Looking at the whole term is at least as precise as at its top
+            for (auto &&c : cands)
+                CHECK(ts.count(c));
+        }
+    }
+}
+
+TEST_CASE("RuleIndex filters")
+{
+    Theory t = cat().upgrade();
+    const RuleIndex &idx = t.rule_index();
+
+    // A composite with an identity on the right only matches the rules
+    // whose input is a composite (or a variable)
+    Expr fid = t.rules.at(1).t2;
+    std::vector<RuleIndex::Candidate> cands = idx.candidates(fid);
+    CHECK(cands.size() < 2 * t.rules.size());
+    CHECK(std::find(cands.begin(), cands.end(), RuleIndex::Candidate{2, false}) != cands.end());
+
+    // Candidates come in the order rules are otherwise tried
+    CHECK(std::is_sorted(cands.begin(), cands.end(), [](auto &a, auto &b) {
+        return a.first != b.first ? a.first < b.first : a.second > b.second;
+    }));
+
+    // Sorts never match a variable
+    for (auto &&[r, forward] : idx.candidates(fid.args.at(0)))
+    {
+        const Rule &rule = t.rules.at(r - 1);
+        CHECK((forward ? rule.t1 : rule.t2).kind != Expr::VarNode);
+    }
+}
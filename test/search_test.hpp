@@ -0,0 +1,42 @@
+#include "../external/catch.hpp"
+#include "../src/search.hpp"
+#include "../src/theories/theories.hpp"
+
+TEST_CASE("rewrite_top")
+{
+    Theory t = cat().upgrade();
+
+    // Right identity in reverse removes the id
+    Expr fid = t.rules.at(1).t2;
+    std::optional<Expr> f = rewrite_top(t, fid, 2, false, 0);
+    REQUIRE(f);
+    CHECK(*f == t.rules.at(1).t1);
+
+    // ...but does not apply in the forward direction to a non-Hom
+    CHECK_FALSE(rewrite_top(t, fid.args.at(0), 2, true, 0));
+
+    // Paths round trip through their names
+    CHECK(path_name({}) == "Empty");
+    CHECK(path_name({1, 2}) == "P12");
+    CHECK(path_from_name("P12") == Vi{1, 2});
+    CHECK(path_from_name("(path 2 1 2 0)") == Vi{1, 2});
+    CHECK(path_from_name("(path 0 0 0)").empty());
+}
+
+TEST_CASE("native_search")
+{
+    Theory t = cat().upgrade();
+    Expr initial = t.upgrade(t.parse_expr("(x:(A:Ob⇒Q:Ob) ⋅ id(Q:Ob))"));
+    Expr final = t.upgrade(t.parse_expr("(id(A:Ob) ⋅ x:(A:Ob⇒Q:Ob))"));
+
+    for (auto &&threads : {1, 4})
+    {
+        SearchResult res = native_search(t, initial, final, 10, 3, threads);
+        REQUIRE(res.status == SearchResult::Found);
+        CHECK(res.steps.size() == 2);
+        CHECK(res.steps.back().result == final);
+    }
+
+    // One step is not enough
+    CHECK(native_search(t, initial, final, 1, 3).status == SearchResult::NotFound);
+}
@@ -0,0 +1,39 @@
+#include <filesystem>
+#include <fstream>
+#include "../external/catch.hpp"
+#include "../src/snapshot.hpp"
+
+TEST_CASE("snapshot")
+{
+    const std::string dir = "build/testsnapshot", src = dir + "/monoid.dat";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::filesystem::copy_file("data/monoid.dat", src);
+    Theory t = Theory::parseTheory(src).upgrade();
+
+    // First call saves the snapshot, second one loads it
+    Theory built = load_theory(src, dir);
+    std::ifstream in(src);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const Hash128 source = Hash128::of(content);
+    REQUIRE(std::filesystem::exists(snapshot_path(source, dir)));
+    std::optional<Theory> loaded = load_snapshot(source, snapshot_path(source, dir));
+    REQUIRE(loaded);
+    CHECK(*loaded == t);
+    CHECK(built == t);
+    CHECK(loaded->hash() == t.hash());
+    CHECK(loaded->symcode() == t.symcode());
+    CHECK(load_theory(src, dir) == t);
+
+    // Snapshots of other contents are not used
+    CHECK(!load_snapshot(Hash128::of(content + " "), snapshot_path(source, dir)));
+    std::ofstream(src, std::ios::app) << "\n";
+    CHECK(!std::filesystem::exists(snapshot_path(Hash128::of(content + "\n"), dir)));
+    CHECK(load_theory(src, dir) == t);
+    CHECK(std::filesystem::exists(snapshot_path(Hash128::of(content + "\n"), dir)));
+
+    // A damaged snapshot is ignored
+    std::filesystem::resize_file(snapshot_path(source, dir), 40);
+    CHECK(!load_snapshot(source, snapshot_path(source, dir)));
+    std::filesystem::remove_all(dir);
+}
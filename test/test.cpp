@@ -9,3 +9,14 @@
 #include "astextra_basic_test.hpp"
 #include "astextra_test.hpp"
 #include "cvc4extra_test.hpp"
+#include "pattern_test.hpp"
+#include "ruleindex_test.hpp"
+#include "reach_test.hpp"
+#include "search_test.hpp"
+#include "egraph_test.hpp"
+#include "portfolio_test.hpp"
+#include "batch_test.hpp"
+#include "cache_test.hpp"
+#include "instrument_test.hpp"
+#include "snapshot_test.hpp"
+#include "modelcheck_test.hpp"
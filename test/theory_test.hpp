@@ -1,3 +1,6 @@
+#include <cstdio>
+#include <fstream>
+#include <thread>
 #include "../external/catch.hpp"
 #include "../src/theory.hpp"
 #include "../src/theories/theories.hpp"
@@ -22,6 +25,78 @@ TEST_CASE("Expr Constructor")
     CHECK_NOTHROW(Expr{"X", Expr::SortNode, {y, y}});
 }
 
+TEST_CASE("Symbol interning")
+{
+    Sym a("Hom"), b(std::string("Hom")), c("Ob");
+    CHECK(a == b);
+    CHECK(a.id() == b.id());
+    CHECK(a != c);
+    CHECK(a.str() == "Hom");
+    CHECK(Sym().empty());
+    CHECK(Sym("").id() == 0);
+    CHECK(App("Hom").sym == a);
+}
+
+TEST_CASE("Hash consing")
+{
+    // Structurally equal terms share one interned node
+    Expr x = Var("x", Srt("Ob")), y = Var("y", Srt("Ob"));
+    Expr xy1 = App("M", {x, y}), xy2 = App("M", {Var("x", Srt("Ob")), y});
+    CHECK(xy1.id() == xy2.id());
+    CHECK(&xy1.args == &xy2.args);
+    CHECK((xy1 == xy2));
+
+    // Kind is part of a node's identity
+    CHECK(App("Ob").id() != Srt("Ob").id());
+    CHECK(App("M", {y, x}).id() != xy1.id());
+}
+
+TEST_CASE("Hash consing across threads")
+{
+    // Threads building the same terms at once still share their nodes
+    auto build = [](std::vector<Expr> &out) {
+        out.push_back(Srt("Ob"));
+        for (int i = 0; i != 2000; i++)
+            out.push_back(App("S" + std::to_string(i % 7), {out.back()}));
+    };
+    std::vector<std::vector<Expr>> built(4);
+    std::vector<std::thread> threads;
+    for (auto &&b : built)
+        threads.emplace_back(build, std::ref(b));
+    for (auto &&th : threads)
+        th.join();
+    for (auto &&b : built)
+    {
+        REQUIRE(b.size() == built.front().size());
+        for (size_t i = 0; i != b.size(); i++)
+            CHECK(b[i] == built.front()[i]);
+    }
+}
+
+TEST_CASE("Structural hash")
+{
+    Expr x = Var("x", Srt("Ob")), y = Var("y", Srt("Ob"));
+    Expr xy = App("M", {x, y}), yx = App("M", {y, x});
+    Expr xyx = App("M", {xy, x});
+    CHECK(xy.hash() == App("M", {x, y}).hash());
+    CHECK(xy.hash() != yx.hash());
+
+    // Preorder positions: root, then (M x y) and its subterms, then x and its sort
+    Positions pos = xyx.positions();
+    CHECK(pos.size() == 8);
+    CHECK(pos.path(0).empty());
+    CHECK((pos.path(1) == Vi{0}));
+    CHECK((pos.terms.at(1) == xy));
+    for (size_t i = 0; i != pos.size(); i++)
+        CHECK((xyx.subexpr(pos.path(i)) == pos.terms.at(i)));
+
+    // x occurs twice, the sort Ob three times
+    std::map<Hash128, Vvi> groups = Expr::distinct(pos);
+    CHECK(groups.size() == 5);
+    CHECK((groups.at(x.hash()) == Vvi{{0, 0}, {1}}));
+    CHECK(groups.at(Srt("Ob").hash()).size() == 3);
+}
+
 TEST_CASE("SubExpr")
 {
     // Symbol is empty
@@ -60,6 +135,26 @@ TEST_CASE("infer")
     Expr g = ut.rules.at(2).t2.args.at(1).args.at(2);
     CHECK_THROWS(Expr::infer(ut.sorts, ut.ops, "cmp", {g, f}));
 }
+
+TEST_CASE("upgrade memo")
+{
+    Theory t = Theory::parseTheory("data/smc.dat");
+
+    // Sharing a memo between terms gives the same results as upgrading each alone
+    UpgradeMemo memo;
+    for (auto &&r : t.rules)
+    {
+        CHECK(r.t1.upgrade(t.sorts, t.ops, &memo) == r.t1.upgrade(t.sorts, t.ops));
+        CHECK(r.t2.upgrade(t.sorts, t.ops, &memo) == r.t2.upgrade(t.sorts, t.ops));
+    }
+
+    // Each distinct subterm (and inferred sort) is elaborated once
+    Expr f = t.rules.at(0).t1;
+    REQUIRE(memo.count(f.id()));
+    size_t n = memo.size();
+    CHECK(f.upgrade(t.sorts, t.ops, &memo) == memo.at(f.id()));
+    CHECK(memo.size() == n);
+}
 TEST_CASE("expr parser and printer")
 {
     Theory t = natarray();
@@ -86,12 +181,69 @@ TEST_CASE("parse theory")
     CHECK(t1 == t2);
 }
 
+TEST_CASE("parse large theory")
+{
+    // Rules come first, so every operator is used before it is declared
+    const std::string pth = "build/testlarge.dat";
+    const int n = 20000;
+    {
+        std::ofstream out(pth);
+        out << "large\n";
+        for (int i = 0; i + 1 < n; i++)
+            out << "Rule r" << i << " \"\" f" << i << "(x:Ob) [[f" << i + 1 << "(x:Ob)|Ob]]\n";
+        out << "Sort Ob \"Ob\" \"\" []\n";
+        for (int i = 0; i != n; i++)
+            out << "Op f" << i << " \"f" << i << "({})\" \"\" Ob [x:Ob]\n";
+    }
+    Theory t = Theory::parseTheory(pth);
+    std::remove(pth.c_str());
+    CHECK(t.name == "large");
+    CHECK(t.ops.size() == n);
+    REQUIRE(t.rules.size() == n - 1);
+    Expr x = Var("x", Srt("Ob"));
+    CHECK(t.rules.at(0).t1 == App("f0", {x}));
+    CHECK(t.rules.at(0).t2 == App("f1", {Srt("Ob"), x}));
+
+    // Syntax errors say where they are
+    {
+        std::ofstream out(pth);
+        out << "bad\nSort Ob \"Ob\" \"\" []\nOp e \"e\" \"\" Ob [)]\n";
+    }
+    CHECK_THROWS_WITH(Theory::parseTheory(pth), Catch::Contains("line 3"));
+    std::remove(pth.c_str());
+}
+
+TEST_CASE("symcode")
+{
+    Theory t = cat().upgrade();
+    const std::map<std::string, int> &sc = t.symcode();
+    for (auto &&[k, v] : sc)
+    {
+        CHECK(t.code(k) == v);
+        CHECK(t.decode(v) == Sym(k));
+    }
+    // Codes are consecutive and alphabetical
+    CHECK(sc.begin()->second == 1);
+    CHECK(sc.rbegin()->second == sc.size());
+    CHECK(t.code("NotInTheTheory") == 0);
+    CHECK(t.decode(0).empty());
+    CHECK(t.decode(sc.size() + 1).empty());
+}
+
+TEST_CASE("Theory hash")
+{
+    // Depends on content only
+    CHECK(cat().upgrade().hash() == cat().upgrade().hash());
+    CHECK(cat().upgrade().hash() != cat().hash());
+    CHECK(cat().hash() != monoid().hash());
+}
+
 TEST_CASE("mk_freevar")
 {
     Expr s = Srt("X");
     Expr x = Var("x", s), y = Var("y", s), z = Var("z", s);
     Expr xy = App("+", {x, y}), xyz = App("f", {z, y, x});
     CHECK(xy.freevar(xyz).empty());
-    std::map<std::string, int> m{{"z", 1}};
+    std::map<Sym, int> m{{"z", 1}};
     CHECK(xyz.freevar(xy) == m);
 }